@@ -0,0 +1,43 @@
+#!/bin/sh
+# End-to-end harness throughput benchmark.
+# Runs scm against two scm-mock engines with --threads 1 to max_threads, and reports games/sec, plies/sec and the CPU time
+# scm itself uses per ply. The mock engines answer instantly by default, so this measures the harness: game turnover,
+# engine I/O and the main loop, and how they scale with the number of concurrent games.
+#
+# usage: bench_harness.sh [max_threads] [games_per_thread] [scm-mock options]
+# max_threads: default: number of CPUs
+# games_per_thread: games played per concurrent game at each step, default 50
+# scm-mock options: e.g. "--delay 5 --info 20 --plies 80", default "--info 10"
+
+max_threads=${1:-$(nproc 2>/dev/null || echo 4)}
+games_per_thread=${2:-50}
+mock_options=${3:-"--info 10"}
+
+bin_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+echo "scm-mock $mock_options, $games_per_thread games per thread"
+printf "%7s %7s %10s %11s %15s\n" threads games games/sec plies/sec "harness us/ply"
+
+threads=1
+while [ "$threads" -le "$max_threads" ]; do
+   games=$((games_per_thread * threads))
+   start=$(date +%s%N)
+   output=$(cd "$work_dir" && "$bin_dir/scm" --e1 "$bin_dir/scm-mock $mock_options" --e2 "$bin_dir/scm-mock $mock_options" \
+            --games "$games" --threads "$threads" --tc 60000 --inc 1000 < /dev/null 2>&1)
+   end=$(date +%s%N)
+
+   games_played=$(echo "$output" | sed -n 's/^Games | N: \([0-9]*\).*/\1/p' | tail -n 1)
+   plies=$(echo "$output" | sed -n 's/^Plies | \([0-9]*\),.*/\1/p' | tail -n 1)
+   us_per_ply=$(echo "$output" | sed -n 's/^Plies | .*, \([0-9.]*\) us\/ply/\1/p' | tail -n 1)
+   if [ -z "$games_played" ] || [ -z "$plies" ]; then
+      echo "scm failed with --threads $threads:"
+      echo "$output" | tail -n 20
+      exit 1
+   fi
+
+   awk -v t="$threads" -v g="$games_played" -v p="$plies" -v us="$us_per_ply" -v ns="$((end - start))" \
+      'BEGIN { s = ns / 1e9; printf "%7d %7d %10.2f %11.1f %15.1f\n", t, g, g / s, p / s, us }'
+   threads=$((threads + 1))
+done
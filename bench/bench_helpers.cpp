@@ -0,0 +1,284 @@
+// Microbenchmarks of the string helpers that run for every engine line or every ply, and of the per-game PGN functions.
+// Reports ns/op and heap allocations/op for each, so that changes to the per-ply cost of the harness show up.
+//
+// usage: bench_helpers [fen4_file]
+// fen4_file: 4 player chess FENs, used to build the 4PC move corpus. Default: FENs_4PC_balanced.txt
+//
+// Corpora: a 2-player game (UCI moves), 4PC pawn moves derived from the FEN openings (with some promotions),
+// engine output lines as sent by Stockfish-like UCI engines, and UCI position commands with 4PC FENs.
+
+#include "gamemanager.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+using namespace std;
+
+struct options_info options;
+
+static uint64_t g_allocations = 0;
+
+// All the replaceable operator new / delete forms (array, nothrow, aligned) go through these two, so every allocation is counted.
+// They are not inlined into operator delete's callers, where GCC would see free() called on a pointer from operator new.
+NOINLINE static void *counted_alloc(size_t size, size_t alignment)
+{
+   g_allocations++;
+   if (size == 0)
+      size = 1;
+   if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      return malloc(size);
+#ifdef _WIN32
+   return _aligned_malloc(size, alignment);
+#else
+   void *p;
+   return (posix_memalign(&p, alignment, size) == 0) ? p : nullptr;
+#endif
+}
+
+NOINLINE static void counted_free(void *p, size_t alignment)
+{
+#ifdef _WIN32
+   if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+   {
+      _aligned_free(p);
+      return;
+   }
+#else
+   (void)alignment;
+#endif
+   free(p);
+}
+
+static void *counted_new(size_t size, size_t alignment)
+{
+   void *p = counted_alloc(size, alignment);
+   if (p == nullptr)
+      throw bad_alloc();
+   return p;
+}
+
+void *operator new(size_t size) { return counted_new(size, 0); }
+void *operator new[](size_t size) { return counted_new(size, 0); }
+void *operator new(size_t size, align_val_t al) { return counted_new(size, (size_t)al); }
+void *operator new[](size_t size, align_val_t al) { return counted_new(size, (size_t)al); }
+void *operator new(size_t size, const nothrow_t &) noexcept { return counted_alloc(size, 0); }
+void *operator new[](size_t size, const nothrow_t &) noexcept { return counted_alloc(size, 0); }
+void *operator new(size_t size, align_val_t al, const nothrow_t &) noexcept { return counted_alloc(size, (size_t)al); }
+void *operator new[](size_t size, align_val_t al, const nothrow_t &) noexcept { return counted_alloc(size, (size_t)al); }
+
+void operator delete(void *p) noexcept { counted_free(p, 0); }
+void operator delete[](void *p) noexcept { counted_free(p, 0); }
+void operator delete(void *p, size_t) noexcept { counted_free(p, 0); }
+void operator delete[](void *p, size_t) noexcept { counted_free(p, 0); }
+void operator delete(void *p, const nothrow_t &) noexcept { counted_free(p, 0); }
+void operator delete[](void *p, const nothrow_t &) noexcept { counted_free(p, 0); }
+void operator delete(void *p, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void *p, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete(void *p, size_t, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void *p, size_t, align_val_t al) noexcept { counted_free(p, (size_t)al); }
+void operator delete(void *p, align_val_t al, const nothrow_t &) noexcept { counted_free(p, (size_t)al); }
+void operator delete[](void *p, align_val_t al, const nothrow_t &) noexcept { counted_free(p, (size_t)al); }
+
+// Runs op(i) for at least 200 ms, and prints ns/op and allocations/op. The result of op is summed, so it isn't optimized away.
+template <typename F>
+static void bench(const string &name, F op)
+{
+   uint64_t iterations = 0;
+   uint64_t checksum = 0;
+   uint64_t allocations_start = g_allocations;
+   chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+   chrono::duration<double> elapsed;
+
+   do
+   {
+      for (int i = 0; i < 1000; i++, iterations++)
+         checksum += op(iterations);
+      elapsed = chrono::steady_clock::now() - start;
+   } while (elapsed < 200ms);
+
+   cout << left << setw(44) << name << right << fixed << setprecision(1) << setw(10) << (elapsed.count() * 1e9 / iterations) << " ns/op"
+        << setprecision(2) << setw(9) << ((double)(g_allocations - allocations_start) / iterations) << " allocs/op" << "   (" << (checksum & 0xff) << ")\n";
+}
+
+// A 2-player game in UCI move format (a Ruy Lopez, 80 plies).
+static const char *const game_2p =
+   "e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7 f1e1 b7b5 a4b3 d7d6 c2c3 e8g8 h2h3 c6b8 d2d4 b8d7 "
+   "b1d2 c8b7 b3c2 f8e8 d2f1 e7f8 f1g3 g7g6 c1g5 h7h6 g5d2 f8g7 a2a4 c7c5 d4d5 c5c4 b2b4 d7b6 a4a5 b6d7 "
+   "d2e3 f6h5 g3h5 g6h5 f3h4 d8f6 h4f5 g8h7 d1h5 e8f8 e1e2 b7c8 a1f1 c8f5 e4f5 f6f5 g2g4 f5f6 f2f4 e5f4 "
+   "e3f4 d7e5 f4e5 d6e5 f1f5 f6g6 h5g6 f7g6 f5f8 a8f8 e2e5 g7e5 c2g6 h7g7 g6e4 f8f1 g1f1 e5c3 f1e2 c3b4";
+
+static vector<string> split(const string &s)
+{
+   vector<string> tokens;
+   size_t start = 0, end;
+   while ((end = s.find(' ', start)) != string::npos)
+   {
+      tokens.push_back(s.substr(start, end - start));
+      start = end + 1;
+   }
+   if (start < s.size())
+      tokens.push_back(s.substr(start));
+   return tokens;
+}
+
+// 4PC pawn moves from a FEN4 position: one step forward for every pawn (red up, yellow down, blue right, green left).
+// The board is 14x14, files a-n, ranks 14 (first row of the FEN) to 1. Cells are comma separated: a piece (e.g. "rP"),
+// a number of empty squares, or "x" for the unused corner squares.
+static void add_4pc_pawn_moves(const string &fen, vector<string> &moves)
+{
+   size_t pos = fen.rfind('-');
+   if (pos == string::npos)
+      return;
+   int rank = 14, file = 0;
+   string cell;
+   for (size_t i = pos + 1; i <= fen.size(); i++)
+   {
+      char c = (i < fen.size()) ? fen[i] : '/';
+      if ((c != ',') && (c != '/'))
+      {
+         cell.push_back(c);
+         continue;
+      }
+      if (isdigit(cell[0]))
+         file += atoi(cell.c_str());
+      else if ((cell.size() == 2) && (cell[1] == 'P'))
+      {
+         int to_file = file + ((cell[0] == 'b') ? 1 : (cell[0] == 'g') ? -1 : 0);
+         int to_rank = rank + ((cell[0] == 'r') ? 1 : (cell[0] == 'y') ? -1 : 0);
+         moves.push_back(string(1, (char)('a' + file)) + to_string(rank) + (char)('a' + to_file) + to_string(to_rank));
+         file++;
+      }
+      else
+         file++;
+      cell.clear();
+      if (c == '/')
+      {
+         rank--;
+         file = 0;
+      }
+   }
+}
+
+static vector<string> make_engine_lines(const vector<string> &fens)
+{
+   vector<string> lines;
+   const string pv = " pv e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7 f1e1 b7b5 a4b3 d7d6 c2c3 e8g8";
+
+   for (int depth = 1; depth <= 20; depth++)
+   {
+      lines.push_back("info depth " + to_string(depth) + " currmove g1f3 currmovenumber " + to_string(depth));
+      lines.push_back("info depth " + to_string(depth) + " seldepth " + to_string(depth + 8) + " multipv 1 score cp " + to_string(20 + (depth % 7)) +
+                      " nodes " + to_string(depth * 123457) + " nps 1534000 hashfull " + to_string(depth * 20) + " tbhits 0 time " + to_string(depth * 80) + pv);
+   }
+   lines.push_back("info string NNUE evaluation using nn-5af11540bbfe.nnue enabled");
+   lines.push_back("bestmove e2e4 ponder e7e5");
+   for (size_t i = 0; (i < fens.size()) && (i < 20); i++)
+      lines.push_back("position fen " + fens[i] + " moves h2h3 b7c7 g13g12 m8l8");
+   return lines;
+}
+
+int main(int argc, char *argv[])
+{
+   string fen_file_name = (argc > 1) ? argv[1] : "FENs_4PC_balanced.txt";
+   ifstream fen_file(fen_file_name);
+   vector<string> fens;
+   string line;
+
+   while (getline(fen_file, line))
+   {
+      rstrip(line);
+      if (!line.empty())
+         fens.push_back(line);
+   }
+   if (fens.empty())
+   {
+      cout << "Error: no FENs in " << fen_file_name << "\n";
+      return 1;
+   }
+
+   vector<string> moves_2p = split(game_2p);
+   vector<string> moves_4pc;
+   for (size_t i = 0; i < fens.size(); i++)
+   {
+      add_4pc_pawn_moves(fens[i], moves_4pc);
+      if ((i % 10) == 0)
+         moves_4pc.back().push_back('q');   // promotion
+   }
+   vector<string> moves_4pc_pgn4 = moves_4pc;
+   for (size_t i = 0; i < moves_4pc_pgn4.size(); i++)
+      convert_move_to_PGN4_format(moves_4pc_pgn4[i]);
+   vector<string> lines = make_engine_lines(fens);
+   vector<string> padded_lines;
+   for (size_t i = 0; i < lines.size(); i++)
+      padded_lines.push_back("  " + lines[i] + " \r\n");
+
+   cout << "corpora: " << moves_2p.size() << " 2-player moves, " << moves_4pc.size() << " 4PC moves from " << fens.size() << " FENs, "
+        << lines.size() << " engine lines\n\n";
+
+   bench("get_tokens (engine line)", [&](uint64_t i) { return get_tokens(lines[i % lines.size()]).size(); });
+   bench("get_first_token (bestmove)", [&](uint64_t i) { return get_first_token("bestmove " + moves_2p[i % moves_2p.size()] + " ponder e7e5", 9).size(); });
+   bench("  string concatenation only (baseline)", [&](uint64_t i) { return ("bestmove " + moves_2p[i % moves_2p.size()] + " ponder e7e5").size(); });
+   bench("rstrip + lstrip (string_view)", [&](uint64_t i)
+   {
+      string_view s = padded_lines[i % padded_lines.size()];
+      rstrip(s);
+      lstrip(s);
+      return s.size();
+   });
+   string scratch;
+   bench("rstrip + lstrip (string, incl. copy)", [&](uint64_t i)
+   {
+      scratch = padded_lines[i % padded_lines.size()];
+      rstrip(scratch);
+      lstrip(scratch);
+      return scratch.size();
+   });
+   string lower;
+   bench("convert_to_lowercase (engine line)", [&](uint64_t i)
+   {
+      convert_to_lowercase(lines[i % lines.size()], lower);
+      return lower.size();
+   });
+   string move;
+   bench("convert_move_to_PGN4_format (4PC)", [&](uint64_t i)
+   {
+      move = moves_4pc[i % moves_4pc.size()];
+      convert_move_to_PGN4_format(move);
+      return move.size();
+   });
+   bench("convert_move_to_standard_engine_format", [&](uint64_t i)
+   {
+      move = moves_4pc_pgn4[i % moves_4pc_pgn4.size()];
+      convert_move_to_standard_engine_format(move);
+      return move.size();
+   });
+
+   // GameManager::replay_moves plays a game's moves with the adjudication checks after each, and stores the PGN unless the
+   // result is UNFINISHED, so the cost of store_pgn is the difference between the two benchmarks of a game.
+   GameManager *game = new GameManager;
+   bench("moves + adjudication (2p, 80 plies)", [&](uint64_t) { return game->replay_moves("", moves_2p, UNFINISHED); });
+   bench("moves + adjudication + store_pgn (2p)", [&](uint64_t) { return game->replay_moves("", moves_2p, WHITE_WIN) + game->m_pgn.size(); });
+
+   options.fourplayerchess = true;
+   options.pgn4_format = true;
+   vector<string> game_4pc(moves_4pc.begin(), moves_4pc.begin() + min((size_t)200, moves_4pc.size()));
+   bench("moves + adjudication (4PC, 200 plies)", [&](uint64_t) { return game->replay_moves(fens[0], game_4pc, UNFINISHED); });
+   bench("moves + adjudication + store_pgn4 (4PC)", [&](uint64_t) { return game->replay_moves(fens[0], game_4pc, WHITE_WIN) + game->m_pgn.size(); });
+   delete game;
+
+   return 0;
+}
@@ -0,0 +1,224 @@
+// Engine output parser benchmark.
+// Replays recorded engine output through the old parsing code (get_tokens / convert_to_lowercase / stringstream)
+// and through the single-pass parser, and reports lines/sec for both.
+//
+// usage: bench_parser [file] [iterations]
+// file: recorded engine output, one line per line. A debug log written by --debug1/--debug2 can be used directly
+//       ("FROM ENGINE n: " lines are replayed, other lines are ignored). If no file is given, a synthetic
+//       Stockfish-like recording is used.
+
+#include "parser.h"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+struct parse_totals
+{
+   int64_t score_sum;
+   int64_t nodes_sum;
+   uint64_t keyword_lines;
+};
+
+// The parsing done by Engine::check_engine_output before the single-pass parser was added.
+static vector<string> legacy_get_tokens(const string &s)
+{
+   vector<string> tokens;
+   size_t start;
+   size_t end = 0;
+
+   while (1)
+   {
+      start = s.find_first_not_of(" \t", end);
+      if (start == string::npos)
+         break;
+      end = s.find_first_of(" \t", start + 1);
+      tokens.push_back(s.substr(start, (end == string::npos) ? string::npos : (end - start)));
+      if (end == string::npos)
+         break;
+   }
+
+   return tokens;
+}
+
+static void legacy_convert_to_lowercase(const string &input_str, string &output_str)
+{
+   output_str = input_str;
+   for (auto &c : output_str)
+      c = tolower(c);
+}
+
+static void legacy_parse(const string &line, bool uci, parse_totals &totals)
+{
+   vector<string> tokens;
+
+   if (uci)
+   {
+      if (line.rfind("info", 0) == 0)
+      {
+         tokens = legacy_get_tokens(line);
+         for (size_t i = 1; i < tokens.size() - 2; i++)
+            if (tokens[i] == "score")
+            {
+               if ((tokens[i + 1] == "cp") || (tokens[i + 1] == "mate"))
+                  totals.score_sum += atoi(tokens[i + 2].c_str());
+            }
+      }
+      if (line.rfind("info string", 0) == 0)
+      {
+         string line_lower;
+         legacy_convert_to_lowercase(line, line_lower);
+
+         if ((line_lower.find("illegal move") != string::npos) || (line_lower.find("invalid move") != string::npos) ||
+             (line_lower.find("invalid fen", 0) != string::npos) || (line_lower.find("invalid position", 0) != string::npos) ||
+             (line_lower.find("illegal fen", 0) != string::npos) || (line_lower.find("illegal position", 0) != string::npos) ||
+             (line_lower.find("white won") != string::npos) || (line_lower.find("black won") != string::npos) ||
+             (line_lower.find("ry won") != string::npos) || (line_lower.find("bg won") != string::npos) ||
+             (line_lower.find("stalemate") != string::npos) || (line_lower.find("offer draw") != string::npos))
+            totals.keyword_lines++;
+      }
+   }
+   else if (isdigit(line[0]))
+   {
+      int ply, score, time, nodes;
+      stringstream ss(line);
+      if (ss >> ply >> score >> time >> nodes)
+      {
+         totals.score_sum += score;
+         totals.nodes_sum += nodes;
+      }
+   }
+}
+
+static void new_parse(const string &line, bool uci, parse_totals &totals)
+{
+   search_info info;
+
+   if (uci)
+   {
+      if (line.rfind("info", 0) == 0)
+      {
+         if (parse_uci_info(line, info) && info.has_score)
+            totals.score_sum += info.score;
+         if (info.nodes >= 0)
+            totals.nodes_sum += info.nodes;
+      }
+      if (line.rfind("info string", 0) == 0)
+      {
+         if (find_info_string_keywords(line) != 0)
+            totals.keyword_lines++;
+      }
+   }
+   else if (isdigit(line[0]))
+   {
+      if (parse_xboard_thinking(line, info))
+      {
+         totals.score_sum += info.score;
+         totals.nodes_sum += info.nodes;
+      }
+   }
+}
+
+static void make_synthetic_recording(vector<string> &lines)
+{
+   const string pv = " pv e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7 f1e1 b7b5 a4b3 d7d6 c2c3 e8g8";
+
+   lines.push_back("info string NNUE evaluation using nn-5af11540bbfe.nnue enabled");
+   for (int depth = 1; depth <= 40; depth++)
+   {
+      for (int move = 1; move <= 20; move++)
+         lines.push_back("info depth " + to_string(depth) + " currmove g1f3 currmovenumber " + to_string(move));
+      lines.push_back("info depth " + to_string(depth) + " seldepth " + to_string(depth + 8) + " multipv 1 score cp " + to_string(20 + (depth % 7)) +
+                      " nodes " + to_string(depth * 123457) + " nps 1534000 hashfull " + to_string(depth * 20) + " tbhits 0 time " + to_string(depth * 80) + pv);
+      lines.push_back("info depth " + to_string(depth) + " seldepth " + to_string(depth + 8) + " multipv 1 score cp " + to_string(25 + (depth % 5)) +
+                      " lowerbound nodes " + to_string(depth * 133457) + " nps 1534000 time " + to_string(depth * 85) + pv);
+   }
+   lines.push_back("info string Illegal move: e2e5");
+   lines.push_back("bestmove e2e4 ponder e7e5");
+}
+
+static double run(const vector<string> &lines, const vector<bool> &uci, int iterations, bool legacy, parse_totals &totals)
+{
+   totals.score_sum = 0;
+   totals.nodes_sum = 0;
+   totals.keyword_lines = 0;
+
+   chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+   for (int i = 0; i < iterations; i++)
+      for (size_t j = 0; j < lines.size(); j++)
+      {
+         if (legacy)
+            legacy_parse(lines[j], uci[j], totals);
+         else
+            new_parse(lines[j], uci[j], totals);
+      }
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+   return ((double)lines.size() * iterations) / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+   vector<string> lines;
+   vector<bool> uci;
+   int iterations = (argc > 2) ? atoi(argv[2]) : 200;
+
+   if (argc > 1)
+   {
+      ifstream file(argv[1]);
+      string line;
+      const string prefix = "FROM ENGINE ";
+
+      if (!file.is_open())
+      {
+         cout << "Error: could not open " << argv[1] << "\n";
+         return 1;
+      }
+      while (getline(file, line))
+      {
+         if (line.rfind(prefix, 0) == 0)
+         {
+            size_t pos = line.find(": ");
+            if (pos == string::npos)
+               continue;
+            line.erase(0, pos + 2);
+         }
+         else if (line.rfind("TO ENGINE ", 0) == 0)
+            continue;
+         if (line.empty())
+            continue;
+         lines.push_back(line);
+      }
+   }
+   else
+      make_synthetic_recording(lines);
+
+   // lines starting with a digit are xboard thinking output, everything else is treated as UCI output.
+   for (size_t i = 0; i < lines.size(); i++)
+      uci.push_back(!isdigit(lines[i][0]));
+
+   if (lines.empty() || (iterations <= 0))
+   {
+      cout << "Error: nothing to replay\n";
+      return 1;
+   }
+
+   parse_totals legacy_totals, new_totals;
+   double legacy_rate = run(lines, uci, iterations, true, legacy_totals);
+   double new_rate = run(lines, uci, iterations, false, new_totals);
+
+   cout << "lines replayed:  " << lines.size() << " x " << iterations << "\n";
+   cout << "before (tokens): " << (uint64_t)legacy_rate << " lines/sec\n";
+   cout << "after (parser):  " << (uint64_t)new_rate << " lines/sec\n";
+   cout << "speedup:         " << (new_rate / legacy_rate) << "x\n";
+   if ((legacy_totals.score_sum != new_totals.score_sum) || (legacy_totals.keyword_lines != new_totals.keyword_lines))
+      cout << "Warning: parsers disagree (score sum " << legacy_totals.score_sum << " vs " << new_totals.score_sum
+           << ", keyword lines " << legacy_totals.keyword_lines << " vs " << new_totals.keyword_lines << ")\n";
+
+   return 0;
+}
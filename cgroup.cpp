@@ -0,0 +1,212 @@
+#include "cgroup.h"
+#include "logger.h"
+#include <fstream>
+#include <sstream>
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+CgroupManager::CgroupManager(void)
+{
+   m_cpuset = false;
+}
+
+bool CgroupManager::is_enabled(void)
+{
+   return !m_harness_path.empty();
+}
+
+#ifdef __linux__
+
+// cgroup files must be written with a single write(), and the error is only reported by that write.
+static bool write_cgroup_file(const string &path, const string &value)
+{
+   int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+   if (fd == -1)
+      return false;
+   bool ok = (write(fd, value.c_str(), value.length()) == (ssize_t)value.length());
+   close(fd);
+   return ok;
+}
+
+static string read_cgroup_file(const string &path)
+{
+   ifstream file(path);
+   string s;
+   getline(file, s);
+   return s;
+}
+
+// Value of a "key value" line in a flat keyed file such as cpu.stat or memory.events, or -1.
+static int64_t read_cgroup_key(const string &path, const string &key)
+{
+   ifstream file(path);
+   string name;
+   int64_t value;
+
+   while (file >> name >> value)
+      if (name == key)
+         return value;
+   return -1;
+}
+
+static bool has_controller(const string &controllers, const string &name)
+{
+   stringstream ss(controllers);
+   string s;
+
+   while (ss >> s)
+      if (s == name)
+         return true;
+   return false;
+}
+
+int CgroupManager::setup(void)
+{
+   string mount_point;
+   string own_path;
+   string line;
+
+   // the cgroup v2 hierarchy, and the cgroup of this process within it ("0::/path" in /proc/self/cgroup).
+   ifstream mounts("/proc/self/mounts");
+   while (mount_point.empty() && getline(mounts, line))
+   {
+      stringstream ss(line);
+      string device, dir, type;
+      if ((ss >> device >> dir >> type) && (type == "cgroup2"))
+         mount_point = dir;
+   }
+   ifstream cgroup("/proc/self/cgroup");
+   while (getline(cgroup, line))
+      if (line.rfind("0::", 0) == 0)
+         own_path = line.substr(3);
+
+   if (mount_point.empty() || own_path.empty())
+   {
+      cout << "Error: --cgroups needs a cgroup v2 hierarchy\n";
+      return 0;
+   }
+   m_base_path = mount_point + ((own_path == "/") ? "" : own_path);
+
+   string controllers = read_cgroup_file(m_base_path + "/cgroup.controllers");
+   if (!has_controller(controllers, "cpu") || !has_controller(controllers, "memory"))
+   {
+      cout << "Error: --cgroups needs the cpu and memory controllers in " << m_base_path << " (available: \"" << controllers << "\")\n";
+      return 0;
+   }
+   m_cpuset = has_controller(controllers, "cpuset");
+
+   // a cgroup that has controllers enabled for its children can't contain processes itself, so the harness moves to a leaf group.
+   m_prefix = "scm" + to_string(getpid()) + "-";
+   string harness_path = m_base_path + "/" + m_prefix + "harness";
+   if ((mkdir(harness_path.c_str(), 0755) != 0) && (errno != EEXIST))
+   {
+      cout << "Error: could not create cgroup " << harness_path << " (" << strerror(errno) << "). "
+           << "Start scm in a delegated cgroup, e.g. with \"systemd-run --user --scope -p Delegate=yes\".\n";
+      return 0;
+   }
+   if (!write_cgroup_file(harness_path + "/cgroup.procs", to_string(getpid())))
+   {
+      cout << "Error: could not move scm to cgroup " << harness_path << " (" << strerror(errno) << ")\n";
+      rmdir(harness_path.c_str());
+      return 0;
+   }
+   m_harness_path = harness_path;
+
+   if (!write_cgroup_file(m_base_path + "/cgroup.subtree_control", m_cpuset ? "+cpu +memory +cpuset" : "+cpu +memory"))
+   {
+      cout << "Error: could not enable the cpu and memory controllers in " << m_base_path << " (" << strerror(errno) << "). "
+           << "The cgroup must not contain processes other than scm.\n";
+      remove_all();
+      return 0;
+   }
+
+   log_event("cgroups: engine groups are created in " + m_base_path + (m_cpuset ? "" : " (cpuset controller not available)"));
+   return 1;
+}
+
+// Create a group for an engine, limited to cores CPUs (cpu.max), memory_mb MB (memory.max) and,
+// if cpu_set isn't empty, to the CPUs in cpu_set (cpuset.cpus). Returns the group's path, or "" on error.
+string CgroupManager::create_group(const string &name, uint cores, uint64_t memory_mb, const vector<int> &cpu_set)
+{
+   const uint64_t period_usec = 100000;
+   string path = m_base_path + "/" + m_prefix + name;
+
+   if ((mkdir(path.c_str(), 0755) != 0) && (errno != EEXIST))
+      return "";
+   m_groups.push_back(path);
+
+   if (!write_cgroup_file(path + "/cpu.max", to_string(cores * period_usec) + " " + to_string(period_usec)) ||
+       !write_cgroup_file(path + "/memory.max", to_string(memory_mb * 1024 * 1024)))
+      return "";
+
+   if (!cpu_set.empty() && m_cpuset)
+   {
+      string cpus;
+      for (size_t i = 0; i < cpu_set.size(); i++)
+         cpus += ((i == 0) ? "" : ",") + to_string(cpu_set[i]);
+      if (!write_cgroup_file(path + "/cpuset.cpus", cpus))
+         return "";
+   }
+   return path;
+}
+
+int CgroupManager::read_stats(const string &path, cgroup_stats &stats)
+{
+   stats.usage_usec = read_cgroup_key(path + "/cpu.stat", "usage_usec");
+   stats.throttled_usec = read_cgroup_key(path + "/cpu.stat", "throttled_usec");
+   stats.nr_throttled = read_cgroup_key(path + "/cpu.stat", "nr_throttled");
+   stats.oom_kills = read_cgroup_key(path + "/memory.events", "oom_kill");
+   try
+   {
+      stats.memory_peak = stoll(read_cgroup_file(path + "/memory.peak"));
+   }
+   catch (...)
+   {
+      stats.memory_peak = -1;
+   }
+   return (stats.usage_usec >= 0) ? 1 : 0;
+}
+
+// Remove the engine groups (their engines must have exited), and move the harness back to the cgroup it was started in.
+void CgroupManager::remove_all(void)
+{
+   for (size_t i = 0; i < m_groups.size(); i++)
+      if (rmdir(m_groups[i].c_str()) != 0)
+         log_event("cgroups: could not remove " + m_groups[i] + " (" + strerror(errno) + ")");
+   m_groups.clear();
+
+   if (m_harness_path.empty())
+      return;
+   write_cgroup_file(m_base_path + "/cgroup.subtree_control", m_cpuset ? "-cpu -memory -cpuset" : "-cpu -memory");
+   write_cgroup_file(m_base_path + "/cgroup.procs", to_string(getpid()));
+   rmdir(m_harness_path.c_str());
+   m_harness_path.clear();
+}
+
+#else
+
+int CgroupManager::setup(void)
+{
+   cout << "Error: --cgroups is only supported on Linux\n";
+   return 0;
+}
+
+string CgroupManager::create_group(const string &, uint, uint64_t, const vector<int> &)
+{
+   return "";
+}
+
+int CgroupManager::read_stats(const string &, cgroup_stats &)
+{
+   return 0;
+}
+
+void CgroupManager::remove_all(void)
+{
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+typedef unsigned int uint;
+
+// Resource usage of a cgroup, read from cpu.stat, memory.peak and memory.events. Values that couldn't be read are -1.
+struct cgroup_stats
+{
+   int64_t usage_usec;        // CPU time used by all processes in the group
+   int64_t throttled_usec;    // time the group was throttled by cpu.max
+   int64_t nr_throttled;      // number of periods in which the group was throttled
+   int64_t memory_peak;       // bytes (memory.peak needs Linux 5.19+)
+   int64_t oom_kills;         // processes killed for exceeding memory.max
+};
+
+// Creates a cgroup v2 group for each engine, with cpu.max, memory.max and cpuset.cpus limits (Linux only).
+// The groups are created next to a leaf group that the harness process is moved to, in the cgroup scm was started in.
+// That cgroup must be delegated to the user and must not contain other processes,
+// e.g. "systemd-run --user --scope -p Delegate=yes ./scm ...".
+class CgroupManager
+{
+public:
+   CgroupManager(void);
+   int setup(void);
+   string create_group(const string &name, uint cores, uint64_t memory_mb, const vector<int> &cpu_set);
+   int read_stats(const string &path, cgroup_stats &stats);
+   void remove_all(void);
+   bool is_enabled(void);
+
+private:
+   string m_base_path;        // the cgroup scm was started in
+   string m_harness_path;     // leaf group the harness process runs in
+   string m_prefix;           // group name prefix, unique to this scm process
+   bool m_cpuset;             // cpuset controller is available
+   vector<string> m_groups;
+};
+
+#endif // CGROUP_H
@@ -0,0 +1,73 @@
+#include "debugring.h"
+#include <cstring>
+#include <cstdio>
+
+DebugRing::DebugRing(void)
+{
+   m_pos = 0;
+   m_wrapped = false;
+   m_start_time = chrono::steady_clock::now();
+}
+
+void DebugRing::resize(size_t bytes)
+{
+   m_buf.assign(bytes, '\0');
+   clear();
+}
+
+bool DebugRing::is_enabled(void)
+{
+   return !m_buf.empty();
+}
+
+// Start capturing a new game.
+void DebugRing::clear(void)
+{
+   m_pos = 0;
+   m_wrapped = false;
+   m_start_time = chrono::steady_clock::now();
+}
+
+// Add a line in the format of the debug logs, e.g. "[1234.567] TO ENGINE 3: go ...", with the time since the game started (ms).
+void DebugRing::add(const char *prefix, uint id, string_view text)
+{
+   if (m_buf.empty())
+      return;
+   char stamp[64];
+   int64_t elapsed_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_start_time).count();
+   int len = snprintf(stamp, sizeof(stamp), "[%lld.%03lld] %s %u: ", (long long)(elapsed_us / 1000), (long long)(elapsed_us % 1000), prefix, id);
+   append(stamp, (size_t)len);
+   append(text.data(), text.size());
+   append("\n", 1);
+}
+
+void DebugRing::append(const char *data, size_t size)
+{
+   // only the end of data fits, if it's larger than the buffer.
+   if (size >= m_buf.size())
+   {
+      data += size - m_buf.size();
+      size = m_buf.size();
+   }
+   size_t first = min(size, m_buf.size() - m_pos);
+   memcpy(&m_buf[m_pos], data, first);
+   memcpy(&m_buf[0], data + first, size - first);
+   m_pos += size;
+   if (m_pos >= m_buf.size())
+   {
+      m_pos -= m_buf.size();
+      m_wrapped = true;
+   }
+}
+
+// The captured lines, oldest first. If older output was overwritten, the partial line at the start is skipped.
+string DebugRing::contents(void)
+{
+   if (!m_wrapped)
+      return string(m_buf.data(), m_pos);
+
+   string lines(m_buf.data() + m_pos, m_buf.size() - m_pos);
+   lines.append(m_buf.data(), m_pos);
+   size_t end = lines.find('\n');
+   return "(earlier output dropped)\n" + ((end == string::npos) ? string() : lines.substr(end + 1));
+}
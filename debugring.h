@@ -0,0 +1,33 @@
+#ifndef DEBUGRING_H
+#define DEBUGRING_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+// In-memory ring buffer of the engine I/O of a game (--debug-failed), written to disk only if the game fails.
+// Each line is stamped with the time since the game started. Once the buffer is full, the oldest lines are overwritten.
+// Only used on the I/O reactor thread.
+class DebugRing
+{
+public:
+   DebugRing(void);
+   void resize(size_t bytes);
+   bool is_enabled(void);
+   void clear(void);
+   void add(const char *prefix, uint id, string_view text);
+   string contents(void);
+
+private:
+   vector<char> m_buf;
+   size_t m_pos;           // where the next byte is written
+   bool m_wrapped;         // older output was overwritten
+   chrono::time_point<chrono::steady_clock> m_start_time;
+
+   void append(const char *data, size_t size);
+};
+
+#endif // DEBUGRING_H
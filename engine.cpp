@@ -1,6 +1,15 @@
 #include "engine.h"
 #include "logger.h"
 #include "simplechessmatch.h"
+#include <fstream>
+#ifdef __linux__
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <dirent.h>
+#endif
 
 namespace bp = boost::process;
 
@@ -11,11 +20,15 @@ Engine::Engine(void)
 {
    m_uci = false;
    m_child_proc = nullptr;
+   m_pidfd = -1;
+   m_alive = false;
+   m_exit_watched = false;
    m_number = FIRST;
    m_color = BLACK;
    m_result = UNFINISHED;
    m_resigned = false;
    m_offered_draw = false;
+   m_startup_time_ms = -1;
    m_is_ready = false;
    m_quit_cmd_sent = false;
    m_xb_feature_ping = false;
@@ -25,8 +38,22 @@ Engine::Engine(void)
    m_xb_feature_usermove = false;
    m_xb_force_mode = false;
    m_debug = false;
+   m_debug_ring = nullptr;
    m_score = 0;
-   m_line.reserve(200);
+   m_rx_buf.resize(rx_chunk_size * 4);
+   m_rx_pos = 0;
+   m_rx_end = 0;
+   m_tx_pos = 0;
+   m_tx_batch = false;
+   m_go_cmd_end = 0;
+   m_go_cmd_pending = false;
+   reset_search_info(m_search_info);
+   m_output_closed = false;
+   m_wait = WAIT_NONE;
+   m_setup_turn = WHITE;
+   m_setup_start_time_ms = 0;
+   m_setup_inc_time_ms = 0;
+   m_setup_fixed_time_ms = 0;
 }
 
 // Engine destructor
@@ -38,6 +65,32 @@ Engine::~Engine(void)
          m_child_proc->terminate();
       delete m_child_proc;
    }
+#ifdef __linux__
+   if (m_pidfd != -1)
+      close(m_pidfd);
+#endif
+}
+
+// Must be called before load_engine.
+void Engine::set_cpu_affinity(const vector<int> &cpu_set)
+{
+   m_cpu_set = cpu_set;
+}
+
+const vector<int> &Engine::cpu_affinity(void)
+{
+   return m_cpu_set;
+}
+
+// Must be called before load_engine.
+void Engine::set_cgroup(const string &path)
+{
+   m_cgroup_path = path;
+}
+
+const string &Engine::cgroup(void)
+{
+   return m_cgroup_path;
 }
 
 int Engine::load_engine(const string &eng_file_name, int ID, engine_number engine_num, bool uci)
@@ -50,16 +103,79 @@ int Engine::load_engine(const string &eng_file_name, int ID, engine_number engin
       if (m_child_proc->running())
          m_child_proc->terminate();
       delete m_child_proc;
+      m_child_proc = nullptr;
+   }
+#ifdef __linux__
+   int cgroup_procs_fd = -1;
+   if (!m_cgroup_path.empty())
+   {
+      cgroup_procs_fd = open((m_cgroup_path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+      if (cgroup_procs_fd == -1)
+         return 0;
    }
+#endif
    try
    {
-      m_child_proc = new bp::child(eng_file_name, bp::std_out > m_out_stream, bp::std_in < m_in_stream);
+#ifdef __linux__
+      if (!m_cpu_set.empty() || (cgroup_procs_fd != -1))
+      {
+         // join the cgroup and set the affinity in the child before exec, so that all threads the engine creates inherit them.
+         // writing "0" to cgroup.procs moves the writing process. The engine must not run outside its cgroup, so exit if that fails.
+         cpu_set_t mask;
+         CPU_ZERO(&mask);
+         for (uint i = 0; i < m_cpu_set.size(); i++)
+            CPU_SET(m_cpu_set[i], &mask);
+         bool set_mask = !m_cpu_set.empty();
+         m_child_proc = new bp::child(eng_file_name, bp::std_out > m_out_pipe, bp::std_in < m_in_pipe,
+                                      bp::extend::on_exec_setup = [&mask, set_mask, cgroup_procs_fd](auto &)
+                                      {
+                                         if ((cgroup_procs_fd != -1) && (write(cgroup_procs_fd, "0", 1) != 1))
+                                            _exit(127);
+                                         if (set_mask)
+                                            sched_setaffinity(0, sizeof(mask), &mask);
+                                      });
+      }
+      else
+#endif
+         m_child_proc = new bp::child(eng_file_name, bp::std_out > m_out_pipe, bp::std_in < m_in_pipe);
    }
    catch (...)
    {
+      m_child_proc = nullptr;
+   }
+#ifdef __linux__
+   if (cgroup_procs_fd != -1)
+      close(cgroup_procs_fd);
+#endif
+   if (m_child_proc == nullptr)
       return 0;
+   m_alive = true;
+   m_launch_time = chrono::steady_clock::now();
+   m_startup_time_ms = -1;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+   // pidfd lets the I/O reactor detect the engine's exit as soon as it happens (Linux 5.3+).
+   if (m_pidfd != -1)
+      close(m_pidfd);
+   m_pidfd = (int)syscall(SYS_pidfd_open, m_child_proc->id(), 0);
+#endif
+
+   // the counters are opened right after the fork, before the engine creates its search threads, so that the threads inherit them.
+   if (options.perf_counters)
+   {
+      static bool perf_warning_shown = false;
+      string error;
+      if ((m_perf.open(m_child_proc->id(), error) == 0) && !perf_warning_shown)
+      {
+         cout << "Warning: --perf: could not open hardware performance counters: " << error << ". Continuing without them.\n";
+         log_event("Warning: --perf: could not open hardware performance counters: " + error);
+         perf_warning_shown = true;
+      }
    }
 
+   if (!options.transcript_dir.empty() && (m_transcript.open(options.transcript_dir + "/engine" + to_string(ID) + ".transcript", eng_file_name, m_launch_time) == 0))
+      log_event("Warning: could not create transcript file in " + options.transcript_dir);
+
    m_ID = ID;
    m_number = engine_num;
    m_uci = uci;
@@ -74,59 +190,85 @@ int Engine::load_engine(const string &eng_file_name, int ID, engine_number engin
    return 1;
 }
 
-int Engine::get_features(void)
+void Engine::send_engine_cmd(const string &cmd)
 {
-   if (m_xb_features_done)
-      return 1; // only need to get features once
+   if (is_running())
+   {
+      if (m_debug)
+         log_debug(m_number, "TO ENGINE " + to_string(m_ID) + ": " + cmd);
+      if (m_debug_ring != nullptr)
+         m_debug_ring->add("TO ENGINE", m_ID, cmd);
+      m_tx_buf.append(cmd);
+      m_tx_buf.push_back('\n');
+      if (!m_tx_batch)
+         flush_engine_cmds();
+   }
+}
 
-   send_engine_cmd("protover 2");
-   m_is_ready = false;
+// While batching, commands are queued and written together by flush_engine_cmds, e.g. all the commands
+// for one turn ("time", "otim", "usermove", "go") are sent to the engine with a single write.
+void Engine::begin_cmd_batch(void)
+{
+   m_tx_batch = true;
+}
 
-   while (1)
-   {
-      if (readline() == 0)
-         return 0;
-      if (m_line[0] == '#')
-         continue;
+void Engine::end_cmd_batch(void)
+{
+   m_tx_batch = false;
+   flush_engine_cmds();
+}
 
-      if (m_line.find("colors=1", 0) != string::npos)
-         m_xb_feature_colors = true;
-      if (m_line.find("ping=1", 0) != string::npos)
-         m_xb_feature_ping = true;
-      if (m_line.find("setboard=0", 0) != string::npos)
-         m_xb_feature_setboard = false;
-      if (m_line.find("san=1", 0) != string::npos)
-         send_engine_cmd("rejected san");
-      if (m_line.find("usermove=1", 0) != string::npos)
-         m_xb_feature_usermove = true;
-
-      // An xboard engine should respond to the "protover 2" command with "feature done=1", or an error message like "Error (unknown command): protover".
-      if (m_line.find("done=1", 0) != string::npos)
+bool Engine::has_pending_cmds(void)
+{
+   return (m_tx_pos < m_tx_buf.size());
+}
+
+// Write the queued commands to the engine's stdin pipe. If the pipe is non-blocking (I/O reactor) and full,
+// the rest of the commands stay queued, and 0 is returned. The reactor calls this again once the pipe has room.
+// Returns 1 if there are no more commands queued.
+int Engine::flush_engine_cmds(void)
+{
+   while (m_tx_pos < m_tx_buf.size())
+   {
+#ifdef __linux__
+      ssize_t len = write(input_handle(), m_tx_buf.data() + m_tx_pos, m_tx_buf.size() - m_tx_pos);
+      if (len < 0)
       {
-         m_xb_features_done = true;
-         m_is_ready = true;
-         return 1;
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN)
+            return 0;
+         break; // engine closed its input. The disconnect is detected on its output.
       }
-      else if (m_line.find("protover", 0) != string::npos)
+#else
+      int len;
+      try
       {
-         // if the engine doesn't support "protover", assume it doesn't support "setboard" either.
-         m_xb_feature_setboard = false;
-         m_xb_features_done = true;
-         m_is_ready = true;
-         return 1;
+         len = m_in_pipe.write(m_tx_buf.data() + m_tx_pos, (int)(m_tx_buf.size() - m_tx_pos));
+      }
+      catch (...)
+      {
+         break;
+      }
+#endif
+      if (m_transcript.is_open())
+         m_transcript.record(TRANSCRIPT_TO_ENGINE, chrono::steady_clock::now(), m_tx_buf.data() + m_tx_pos, len);
+      m_tx_pos += len;
+      if (m_go_cmd_pending && (m_tx_pos >= m_go_cmd_end))
+      {
+         m_go_time = chrono::steady_clock::now();
+         m_go_cmd_pending = false;
       }
    }
-}
 
-void Engine::send_engine_cmd(const string &cmd)
-{
-   if (is_running())
+   if (m_go_cmd_pending)
    {
-      if (m_debug)
-         log_debug(m_number, "TO ENGINE " + to_string(m_ID) + ": " + cmd);
-      m_in_stream << cmd << "\n";
-      m_in_stream.flush();
+      m_go_time = chrono::steady_clock::now();
+      m_go_cmd_pending = false;
    }
+   m_tx_buf.clear();
+   m_tx_pos = 0;
+   return 1;
 }
 
 void Engine::send_quit_cmd(void)
@@ -135,67 +277,391 @@ void Engine::send_quit_cmd(void)
    send_engine_cmd("quit");
 }
 
-int Engine::readline(void)
+// Startup commands (e.g. engine options) are sent during the startup handshake, once the engine has identified itself.
+void Engine::add_startup_cmd(const string &cmd)
+{
+   m_startup_cmds.push_back(cmd);
+}
+
+// Start the startup handshake: "uci" -> "uciok" (UCI) or "protover 2" -> features (xboard), then the startup commands,
+// then "isready" -> "readyok" (or the xboard equivalent), so that hash allocation etc. is done before the first game.
+// Completes with EVENT_STARTED.
+void Engine::engine_startup(void)
 {
-   // note: getline is blocking.
-   getline(m_out_stream, m_line);
-   if (m_out_stream.eof())
+   if (m_uci)
+      m_wait = WAIT_UCIOK;
+   else
    {
-      if (m_debug)
-         log_debug(m_number, "ENGINE " + to_string(m_ID) + " DISCONNECTED");
+      send_engine_cmd("protover 2");
+      m_is_ready = false;
+      m_wait = WAIT_FEATURES;
+   }
+}
+
+// Native handle of the engine's stdin pipe, used by the I/O reactor.
+int Engine::input_handle(void)
+{
+   return m_in_pipe.native_sink();
+}
+
+// Native handle of the engine's stdout pipe, used by the I/O reactor.
+int Engine::output_handle(void)
+{
+   return m_out_pipe.native_source();
+}
+
+// Blocking read from the engine's stdout pipe. Returns 0 if the engine closed its output.
+int Engine::read_output(char *buf, int size)
+{
+   try
+   {
+      return m_out_pipe.read(buf, size);
+   }
+   catch (...)
+   {
+      return 0;
+   }
+}
+
+// Make room for at least rx_chunk_size more bytes of engine output at the end of m_rx_buf.
+// While nothing waits for the engine, complete lines are dropped once rx_discard_size bytes are buffered, so an engine
+// that keeps writing between searches can't grow the buffer without limit. Returns false, without growing the buffer,
+// if the output not yet consumed would exceed rx_max_size. Invalidates m_line.
+bool Engine::reserve_output_space(void)
+{
+   if (m_rx_buf.size() - m_rx_end >= rx_chunk_size)
+      return true;
+
+   if ((m_wait == WAIT_NONE) && (m_rx_end - m_rx_pos >= rx_discard_size))
+   {
+      size_t last_newline = m_rx_buf.rfind('\n', m_rx_end - 1);
+      if ((last_newline != string::npos) && (last_newline >= m_rx_pos))
+         m_rx_pos = last_newline + 1;
+   }
+
+   // move the output not yet consumed (usually just a partial line) to the start of the buffer.
+   if (m_rx_pos > 0)
+   {
+      memmove(&m_rx_buf[0], &m_rx_buf[m_rx_pos], m_rx_end - m_rx_pos);
+      m_rx_end -= m_rx_pos;
+      m_rx_pos = 0;
+   }
+   if (m_rx_buf.size() - m_rx_end < rx_chunk_size)
+   {
+      if (m_rx_buf.size() * 2 > rx_max_size)
+      {
+         log_event("Error: " + m_name + " (" + to_string(m_ID) + "): more than " + to_string(rx_max_size >> 20)
+                   + " MB of unread output");
+         return false;
+      }
+      m_rx_buf.resize(m_rx_buf.size() * 2);
+   }
+   return true;
+}
+
+// Non-blocking read from the engine's stdout pipe, directly into m_rx_buf. Used by the I/O reactor on Linux.
+// Returns the number of bytes read, 0 if the engine closed its output, or -1 if no data is available (see errno).
+// An engine whose unread output exceeds rx_max_size is treated as if it closed its output, so it gets disconnected.
+int Engine::receive_output(void)
+{
+#ifdef __linux__
+   if (!reserve_output_space())
       return 0;
+   ssize_t len = ::read(output_handle(), &m_rx_buf[m_rx_end], m_rx_buf.size() - m_rx_end);
+   if (len > 0)
+   {
+      m_rx_time = chrono::steady_clock::now();
+      if (m_transcript.is_open())
+         m_transcript.record(TRANSCRIPT_FROM_ENGINE, m_rx_time, &m_rx_buf[m_rx_end], len);
+      m_rx_end += len;
+   }
+   return (int)len;
+#else
+   return -1;
+#endif
+}
+
+void Engine::append_output(const char *data, size_t len)
+{
+   if (m_output_closed)
+      return;
+   m_rx_time = chrono::steady_clock::now();
+   if (m_transcript.is_open())
+      m_transcript.record(TRANSCRIPT_FROM_ENGINE, m_rx_time, data, len);
+   while (len > 0)
+   {
+      if (!reserve_output_space())
+      {
+         close_output();
+         return;
+      }
+      size_t n = min(len, m_rx_buf.size() - m_rx_end);
+      memcpy(&m_rx_buf[m_rx_end], data, n);
+      m_rx_end += n;
+      data += n;
+      len -= n;
+   }
+}
+
+void Engine::close_output(void)
+{
+   m_output_closed = true;
+   if (m_transcript.is_open())
+   {
+      m_transcript.record(TRANSCRIPT_CLOSED, chrono::steady_clock::now(), nullptr, 0);
+      m_transcript.close();
+   }
+}
+
+bool Engine::is_output_closed(void)
+{
+   return m_output_closed;
+}
+
+// Returns 1 if a complete line is available in m_line. Returns 0 if no complete line has been received yet.
+// m_line refers to the line in place in m_rx_buf, so lines are not copied.
+// Once the engine has closed its output, the rest of the output is a last line without a newline, e.g. a "bestmove"
+// written just before the engine exited.
+int Engine::readline(void)
+{
+   const char *start = m_rx_buf.data() + m_rx_pos;
+   const char *end = (const char *)memchr(start, '\n', m_rx_end - m_rx_pos);
+   if (end != nullptr)
+   {
+      m_line = string_view(start, end - start);
+      m_rx_pos += (end - start) + 1;
+   }
+   else if (m_output_closed && (m_rx_pos < m_rx_end))
+   {
+      m_line = string_view(start, m_rx_end - m_rx_pos);
+      m_rx_pos = m_rx_end;
    }
+   else
+      return 0;
    rstrip(m_line);
    lstrip(m_line);
    if (m_debug)
-      log_debug(m_number, "FROM ENGINE " + to_string(m_ID) + ": " + m_line);
+      log_debug(m_number, "FROM ENGINE " + to_string(m_ID) + ": " + string(m_line));
+   if (m_debug_ring != nullptr)
+      m_debug_ring->add("FROM ENGINE", m_ID, m_line);
    return 1;
 }
 
-int Engine::wait_for_ready(bool check_output)
+// Process buffered engine output, for as long as the engine is being waited on.
+// Output received while the engine isn't being waited on stays buffered until the next wait.
+engine_event Engine::process_output(void)
 {
-   m_is_ready = false;
-   if (m_uci)
-      send_engine_cmd("isready");
-   else if (m_xb_feature_ping)
-      send_engine_cmd("ping 1");
-   else
-      send_engine_cmd("protover 2");
+   engine_event event = EVENT_NONE;
 
-   while (1)
+   while ((m_wait != WAIT_NONE) && (event == EVENT_NONE))
    {
       if (readline() == 0)
-         return 0;
-      if (m_uci)
       {
-         if (m_line.rfind("readyok", 0) == 0)
+         if (!m_output_closed)
+            break;
+         if (m_debug)
+            log_debug(m_number, "ENGINE " + to_string(m_ID) + " DISCONNECTED");
+         if (m_debug_ring != nullptr)
+            m_debug_ring->add("ENGINE", m_ID, "DISCONNECTED");
+         m_wait = WAIT_NONE;
+         return EVENT_DISCONNECTED;
+      }
+      event = handle_line();
+   }
+   if (event == EVENT_MOVE)
+      m_move_time = m_rx_time;
+   return event;
+}
+
+void Engine::cancel_wait(void)
+{
+   m_wait = WAIT_NONE;
+}
+
+engine_event Engine::handle_line(void)
+{
+   if (m_wait == WAIT_FEATURES)
+      return handle_feature_line();
+
+   if (m_wait == WAIT_UCIOK)
+   {
+      if (m_line.rfind("uciok", 0) == 0)
+         send_startup_cmds();
+      return EVENT_NONE;
+   }
+
+   if ((m_wait == WAIT_STARTUP_READY) || (m_wait == WAIT_SETUP_READY) || (m_wait == WAIT_READY))
+   {
+      if (is_ready_response())
+      {
+         m_is_ready = true;
+         if (m_wait == WAIT_STARTUP_READY)
+         {
+            m_startup_time_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_launch_time).count();
+            m_wait = WAIT_NONE;
+            return EVENT_STARTED;
+         }
+         if (m_wait == WAIT_READY)
          {
-            m_is_ready = true;
-            return 1;
+            m_wait = WAIT_NONE;
+            return EVENT_READY;
          }
+         m_wait = WAIT_NONE;
+         finish_new_game_setup();
+         return EVENT_SETUP_DONE;
       }
-      else if (m_xb_feature_ping)
+      if (m_wait == WAIT_READY)
+         check_engine_output();
+      return EVENT_NONE;
+   }
+
+   if (m_wait == WAIT_MOVE_PART_2)
+   {
+      if (m_line.rfind("move ", 0) == 0)
+         m_move.append(m_line.substr(5));
+      m_wait = WAIT_NONE;
+      return EVENT_MOVE;
+   }
+
+   // WAIT_MOVE
+   if (m_uci)
+   {
+      if (m_line.rfind("bestmove", 0) == 0)
       {
-         if (m_line.rfind("pong 1", 0) == 0)
+         m_move = get_first_token(m_line, 9);
+
+         // If the engine sent a "null" move, then the engine has no legal moves, and is mated or stalemated.
+         // The engine should send "0000" in this case, but many UCI engines send one of the alternatives below.
+         if ((m_move == "0000") || (m_move == "(none)") || (m_move == "none") || (m_move == "a1a1") || (m_move == ""))
          {
-            m_is_ready = true;
-            return 1;
+            m_result = NO_LEGAL_MOVES;
+            m_move = "";
          }
+
+         m_wait = WAIT_NONE;
+         return EVENT_MOVE;
       }
-      else
+   }
+   else
+   {
+      if (m_line.rfind("move ", 0) == 0)
       {
-         if ((m_line.find("done=1", 0) != string::npos) || (m_line.find("protover", 0) != string::npos))
+         m_move = m_line.substr(5);
+         // Handle multi-part moves (required for duck chess variant).
+         // If move ends with a comma, the 2nd part of the move will be on the next line.
+         if (!m_move.empty() && (m_move[m_move.length() - 1] == ','))
          {
-            m_is_ready = true;
-            return 1;
+            m_wait = WAIT_MOVE_PART_2;
+            return EVENT_NONE;
          }
+         m_wait = WAIT_NONE;
+         return EVENT_MOVE;
       }
-      if (check_output)
-         check_engine_output();
    }
+   check_engine_output();
+   if (m_result != UNFINISHED)
+   {
+      m_wait = WAIT_NONE;
+      return EVENT_MOVE;
+   }
+   return EVENT_NONE;
+}
+
+engine_event Engine::handle_feature_line(void)
+{
+   if (!m_line.empty() && (m_line[0] == '#'))
+      return EVENT_NONE;
+
+   if (m_line.find("colors=1", 0) != string::npos)
+      m_xb_feature_colors = true;
+   if (m_line.find("ping=1", 0) != string::npos)
+      m_xb_feature_ping = true;
+   if (m_line.find("setboard=0", 0) != string::npos)
+      m_xb_feature_setboard = false;
+   if (m_line.find("san=1", 0) != string::npos)
+      send_engine_cmd("rejected san");
+   if (m_line.find("usermove=1", 0) != string::npos)
+      m_xb_feature_usermove = true;
+
+   // An xboard engine should respond to the "protover 2" command with "feature done=1", or an error message like "Error (unknown command): protover".
+   if (m_line.find("done=1", 0) != string::npos)
+   {
+      m_xb_features_done = true;
+      m_is_ready = true;
+      if (m_startup_time_ms < 0)
+         send_startup_cmds();
+      else
+         xb_new_game();
+   }
+   else if (m_line.find("protover", 0) != string::npos)
+   {
+      // if the engine doesn't support "protover", assume it doesn't support "setboard" either.
+      m_xb_feature_setboard = false;
+      m_xb_features_done = true;
+      m_is_ready = true;
+      if (m_startup_time_ms < 0)
+         send_startup_cmds();
+      else
+         xb_new_game();
+   }
+   return EVENT_NONE;
+}
+
+void Engine::send_startup_cmds(void)
+{
+   for (uint i = 0; i < m_startup_cmds.size(); i++)
+      send_engine_cmd(m_startup_cmds[i]);
+   send_ready_cmd();
+   m_wait = WAIT_STARTUP_READY;
+}
+
+void Engine::send_ready_cmd(void)
+{
+   m_is_ready = false;
+   if (m_uci)
+      send_engine_cmd("isready");
+   else if (m_xb_feature_ping)
+      send_engine_cmd("ping 1");
+   else
+      send_engine_cmd("protover 2");
+}
+
+bool Engine::is_ready_response(void)
+{
+   if (m_uci)
+      return (m_line.rfind("readyok", 0) == 0);
+   if (m_xb_feature_ping)
+      return (m_line.rfind("pong 1", 0) == 0);
+   return ((m_line.find("done=1", 0) != string::npos) || (m_line.find("protover", 0) != string::npos));
+}
+
+// Wait for engine to be ready, while checking its output for a game result. Completes with EVENT_READY.
+void Engine::wait_for_ready(void)
+{
+   send_ready_cmd();
+   m_wait = WAIT_READY;
+}
+
+// Wait for engine's move. Completes with EVENT_MOVE.
+// The engine's clock starts (m_go_time) once the commands sent before this call, ending with "go", are written to its stdin pipe.
+void Engine::request_move(void)
+{
+   m_move = "";
+   m_wait = WAIT_MOVE;
+   m_search_info.time_ms = -1;
+   m_search_info.nodes = -1;
+   m_search_info.nps = -1;
+   if (has_pending_cmds())
+   {
+      m_go_cmd_end = m_tx_buf.size();
+      m_go_cmd_pending = true;
+   }
+   else
+      m_go_time = chrono::steady_clock::now();
 }
 
-int Engine::engine_new_game_setup(player_color color, player_color turn, int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms, const string &fen, const string &variant)
+// Start new game setup. Completes with EVENT_SETUP_DONE.
+void Engine::engine_new_game_setup(player_color color, player_color turn, int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms, const string &fen, const string &variant)
 {
    m_result = UNFINISHED;
    m_resigned = false;
@@ -203,17 +669,54 @@ int Engine::engine_new_game_setup(player_color color, player_color turn, int64_t
    m_color = color;
    m_score = 0;
    m_opponent_move = "none";
+   reset_search_info(m_search_info);
+
+   m_setup_turn = turn;
+   m_setup_start_time_ms = start_time_ms;
+   m_setup_inc_time_ms = inc_time_ms;
+   m_setup_fixed_time_ms = fixed_time_ms;
+   m_setup_fen = fen;
+   m_setup_variant = variant;
 
    if (m_uci)
    {
       send_engine_cmd("ucinewgame");
-      if (!wait_for_ready(false))
-         return 0;
+      send_ready_cmd();
+      m_wait = WAIT_SETUP_READY;
+   }
+   else if (!m_xb_features_done)
+   {
+      // only need to get features once
+      send_engine_cmd("protover 2");
+      m_is_ready = false;
+      m_wait = WAIT_FEATURES;
+   }
+   else
+      xb_new_game();
+}
+
+void Engine::xb_new_game(void)
+{
+   send_engine_cmd("new");
+   send_ready_cmd();
+   m_wait = WAIT_SETUP_READY;
+}
 
+void Engine::finish_new_game_setup(void)
+{
+   const string &fen = m_setup_fen;
+   const string &variant = m_setup_variant;
+   player_color turn = m_setup_turn;
+   int64_t start_time_ms = m_setup_start_time_ms;
+   int64_t inc_time_ms = m_setup_inc_time_ms;
+   int64_t fixed_time_ms = m_setup_fixed_time_ms;
+
+   if (m_uci)
+   {
       if (!variant.empty())
          send_engine_cmd("setoption name UCI_Variant value " + variant);
 
-      if (turn == color)
+      if (turn == m_color)
       {
          if (!fen.empty())
             send_engine_cmd("position fen " + fen);
@@ -223,12 +726,6 @@ int Engine::engine_new_game_setup(player_color color, player_color turn, int64_t
    }
    else
    {
-      if (!get_features())
-         return 0;
-      send_engine_cmd("new");
-      if (!wait_for_ready(false))
-         return 0;
-
       if (!variant.empty())
          send_engine_cmd("variant " + variant);
 
@@ -284,8 +781,6 @@ int Engine::engine_new_game_setup(player_color color, player_color turn, int64_t
             send_engine_cmd("black");
       }
    }
-
-   return 1;
 }
 
 void Engine::engine_new_game_start(int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms)
@@ -312,57 +807,10 @@ void Engine::engine_new_game_start(int64_t start_time_ms, int64_t inc_time_ms, i
    }
 }
 
-int Engine::get_engine_move(void)
-{
-   m_move = "";
-
-   while (1)
-   {
-      if (readline() == 0)
-         return 0;
-      if (m_uci)
-      {
-         if (m_line.rfind("bestmove", 0) == 0)
-         {
-            m_move = get_first_token(m_line, 9);
-
-            // If the engine sent a "null" move, then the engine has no legal moves, and is mated or stalemated.
-            // The engine should send "0000" in this case, but many UCI engines send one of the alternatives below.
-            if ((m_move == "0000") || (m_move == "(none)") || (m_move == "none") || (m_move == "a1a1") || (m_move == ""))
-            {
-               m_result = NO_LEGAL_MOVES;
-               m_move = "";
-            }
-
-            return 1;
-         }
-      }
-      else
-      {
-         if (m_line.rfind("move ", 0) == 0)
-         {
-            m_move = m_line.substr(5);
-            // Handle multi-part moves (required for duck chess variant).
-            // If move ends with a comma, the 2nd part of the move will be on the next line.
-            if (m_move[m_move.length() - 1] == ',')
-            {
-               if (readline() == 0)
-                  return 0;
-               if (m_line.rfind("move ", 0) == 0)
-                  m_move.append(m_line.substr(5));
-            }
-            return 1;
-         }
-      }
-      check_engine_output();
-      if (m_result != UNFINISHED)
-         return 1;
-   }
-}
 
 void Engine::check_engine_output(void)
 {
-   vector<string> tokens;
+   search_info info;
 
    if (m_uci)
    {
@@ -371,63 +819,63 @@ void Engine::check_engine_output(void)
       if (m_line.rfind("info", 0) == 0)
       {
          // check for score. e.g. "info score cp 123" or "info score mate -3"
-         tokens = get_tokens(m_line);
-         for (size_t i = 1; i < tokens.size() - 2; i++)
-            if (tokens[i] == "score")
+         if (parse_uci_info(m_line, info))
+         {
+            update_search_info(info);
+            if (info.has_score)
             {
-               if (tokens[i + 1] == "cp")
+               if (!info.mate_score)
                {
-                  m_score = atoi(tokens[i + 2].c_str());
+                  m_score = info.score;
                   if (m_score >= mate_score)
                      m_score = mate_score - 1;
                   if (m_score <= mate_score_neg)
                      m_score = mate_score_neg + 1;
                }
-               else if (tokens[i + 1] == "mate")
+               else
                {
-                  int n = atoi(tokens[i + 2].c_str());
+                  int n = info.score;
                   m_score = (n <= 0) ? (mate_score_neg + n) : (mate_score + n);
                }
             }
+         }
       }
 
       if (m_line.rfind("info string", 0) == 0)
       {
-         string line_lower;
-         convert_to_lowercase(m_line, line_lower);
+         unsigned int keywords = find_info_string_keywords(m_line);
 
-         if ((line_lower.find("illegal move") != string::npos) || (line_lower.find("invalid move") != string::npos))
+         if (keywords & KEYWORD_ILLEGAL_MOVE)
          {
             log_event("Illegal move reported by " + m_name);
             m_result = ERROR_ILLEGAL_MOVE;
          }
-         else if ((line_lower.find("invalid fen", 0) != string::npos) || (line_lower.find("invalid position", 0) != string::npos) ||
-                  (line_lower.find("illegal fen", 0) != string::npos) || (line_lower.find("illegal position", 0) != string::npos))
+         else if (keywords & KEYWORD_INVALID_POSITION)
          {
             log_event("Invalid position reported by " + m_name);
             m_result = ERROR_INVALID_POSITION;
          }
          // 4pchess (https://github.com/obryanlouis/4pchess) uses "RY won" / "BG won" / "Stalemate".
-         else if (line_lower.find("white won") != string::npos)
+         else if (keywords & KEYWORD_WHITE_WON)
             m_result = WHITE_WIN;
-         else if (line_lower.find("black won") != string::npos)
+         else if (keywords & KEYWORD_BLACK_WON)
             m_result = BLACK_WIN;
-         else if (line_lower.find("ry won") != string::npos)
+         else if (keywords & KEYWORD_RY_WON)
             m_result = WHITE_WIN;
-         else if (line_lower.find("bg won") != string::npos)
+         else if (keywords & KEYWORD_BG_WON)
             m_result = BLACK_WIN;
-         else if (line_lower.find("stalemate") != string::npos)
+         else if (keywords & KEYWORD_STALEMATE)
             m_result = DRAW;
-         else if (line_lower.find("offer draw") != string::npos)
+         else if (keywords & KEYWORD_OFFER_DRAW)
             m_offered_draw = true;
       }
    }
    else
    {
-      if (m_line[0] == '#')
+      if (m_line.empty() || (m_line[0] == '#'))
          return;
       if ((m_line.rfind("Illegal move:", 0) == 0) ||
-          (m_line.rfind("Error (unknown command): " + m_opponent_move) == 0))
+          ((m_line.rfind("Error (unknown command): ", 0) == 0) && (m_line.substr(25).rfind(m_opponent_move, 0) == 0)))
       {
          log_event("Illegal move reported by " + m_name);
          m_result = ERROR_ILLEGAL_MOVE;
@@ -452,11 +900,11 @@ void Engine::check_engine_output(void)
          m_offered_draw = true;
       else if (isdigit(m_line[0]))
       {
-         int ply, score, time, nodes;
-         stringstream ss(m_line);
-         if (ss >> ply >> score >> time >> nodes)
+         // thinking output: "ply score time nodes pv"
+         if (parse_xboard_thinking(m_line, info))
          {
-            m_score = score;
+            update_search_info(info);
+            m_score = info.score;
             if (m_score > (mate_score + 999))
                m_score = (mate_score + 999);
             if (m_score < (mate_score_neg - 999))
@@ -466,15 +914,31 @@ void Engine::check_engine_output(void)
    }
 }
 
-void Engine::send_move_and_clocks_to_engine(const string &move, const string &startfen, const string &movelist, int64_t engine_clock_ms, int64_t opp_clock_ms, int64_t rtime, int64_t bltime, int64_t ytime, int64_t gtime, int64_t inc_ms, int64_t fixed_time_ms)
+// Keep the most recent search info values reported by the engine.
+void Engine::update_search_info(const search_info &info)
+{
+   if (info.depth >= 0)
+      m_search_info.depth = info.depth;
+   if (info.nodes >= 0)
+      m_search_info.nodes = info.nodes;
+   if (info.nps >= 0)
+      m_search_info.nps = info.nps;
+   if (info.time_ms >= 0)
+      m_search_info.time_ms = info.time_ms;
+   if (info.has_score)
+   {
+      m_search_info.has_score = true;
+      m_search_info.mate_score = info.mate_score;
+      m_search_info.score = info.score;
+   }
+}
+
+void Engine::send_move_and_clocks_to_engine(const string &move, const string &position_cmd, int64_t engine_clock_ms, int64_t opp_clock_ms, int64_t rtime, int64_t bltime, int64_t ytime, int64_t gtime, int64_t inc_ms, int64_t fixed_time_ms)
 {
    m_opponent_move = move;
    if (m_uci)
    {
-      if (startfen.empty())
-         send_engine_cmd("position startpos moves " + movelist);
-      else
-         send_engine_cmd("position fen " + startfen + " moves " + movelist);
+      send_engine_cmd(position_cmd);
 
       if (fixed_time_ms == 0)
       {
@@ -529,12 +993,105 @@ void Engine::send_result_to_engine(game_result result)
    }
 }
 
+// While the I/O reactor watches the engine's pidfd, this is just a flag check. Otherwise the child process is checked,
+// which costs a syscall.
 bool Engine::is_running(void)
 {
-   if (m_child_proc != nullptr)
-      if (m_child_proc->running())
-         return true;
+   if (!m_alive)
+      return false;
+   if (m_exit_watched)
+      return true;
+   if ((m_child_proc != nullptr) && m_child_proc->running())
+      return true;
+   m_alive = false;
+   return false;
+}
+
+// Read the engine process's CPU time, memory and context switches from /proc. Returns false if they aren't available.
+// Context switches are only counted per thread by the kernel, so they are summed over /proc/<pid>/task/*/status.
+bool Engine::sample_process_stats(process_stats &stats)
+{
+#ifdef __linux__
+   if (!is_running())
+      return false;
+
+   string proc_dir = "/proc/" + to_string(m_child_proc->id());
+   ifstream stat_file(proc_dir + "/stat");
+   string line;
+   if (!getline(stat_file, line))
+      return false;
+
+   // fields after the command name, which is in parentheses and may contain spaces: state is field 3, utime 14, stime 15.
+   size_t pos = line.rfind(')');
+   if (pos == string::npos)
+      return false;
+   vector<string> fields = get_tokens(string_view(line).substr(pos + 1));
+   if (fields.size() < 13)
+      return false;
+   long ticks_per_second = sysconf(_SC_CLK_TCK);
+   stats.cpu_ms = ((stoll(fields[11]) + stoll(fields[12])) * 1000) / ((ticks_per_second > 0) ? ticks_per_second : 100);
+
+   stats.rss_kb = 0;
+   stats.peak_rss_kb = 0;
+   ifstream status_file(proc_dir + "/status");
+   while (getline(status_file, line))
+   {
+      if (line.rfind("VmRSS:", 0) == 0)
+         stats.rss_kb = atoll(line.c_str() + 6);
+      else if (line.rfind("VmHWM:", 0) == 0)
+         stats.peak_rss_kb = atoll(line.c_str() + 6);
+   }
+
+   stats.voluntary_switches = 0;
+   stats.involuntary_switches = 0;
+   DIR *task_dir = opendir((proc_dir + "/task").c_str());
+   if (task_dir == nullptr)
+      return false;
+   while (dirent *entry = readdir(task_dir))
+   {
+      if (entry->d_name[0] == '.')
+         continue;
+      ifstream task_status(proc_dir + "/task/" + entry->d_name + "/status");
+      while (getline(task_status, line))
+      {
+         if (line.rfind("voluntary_ctxt_switches:", 0) == 0)
+            stats.voluntary_switches += atoll(line.c_str() + 24);
+         else if (line.rfind("nonvoluntary_ctxt_switches:", 0) == 0)
+            stats.involuntary_switches += atoll(line.c_str() + 27);
+      }
+   }
+   closedir(task_dir);
+   return true;
+#else
    return false;
+#endif
+}
+
+// Read the engine's hardware performance counters (--perf). Returns false if they aren't open.
+bool Engine::read_perf_counters(perf_counts &counts)
+{
+   if (!m_perf.is_open())
+      return false;
+   m_perf.read(counts);
+   return true;
+}
+
+int Engine::exit_handle(void)
+{
+   return m_pidfd;
+}
+
+void Engine::set_exit_watched(bool watched)
+{
+   m_exit_watched = watched;
+}
+
+// Called by the I/O reactor when the engine's pidfd becomes readable.
+void Engine::process_exited(void)
+{
+   if (m_child_proc != nullptr)
+      m_child_proc->running(); // reap the process
+   m_alive = false;
 }
 
 // This function may need to be used if engine doesn't respond to "quit" command in a timely manner.
@@ -543,6 +1100,7 @@ void Engine::force_exit(void)
    if (is_running())
    {
       m_child_proc->terminate();
+      m_alive = false;
       log_event(m_name + " (" + to_string(m_ID) + "): forced exit");
    }
 }
@@ -609,6 +1167,28 @@ void Engine::update_game_result(void)
    }
 }
 
+// The engine's own search time for its last move ("info time", or the xboard thinking output time), or -1 if not reported.
+int64_t Engine::get_reported_time_ms(void)
+{
+   return m_search_info.time_ms;
+}
+
+// Nodes searched for the engine's last move, or -1 if not reported.
+int64_t Engine::get_reported_nodes(void)
+{
+   return m_search_info.nodes;
+}
+
+// NPS of the engine's last move: "info nps", or nodes / time if the engine doesn't report NPS (xboard). -1 if not reported.
+int64_t Engine::get_reported_nps(void)
+{
+   if (m_search_info.nps >= 0)
+      return m_search_info.nps;
+   if ((m_search_info.nodes > 0) && (m_search_info.time_ms > 0))
+      return (m_search_info.nodes * 1000) / m_search_info.time_ms;
+   return -1;
+}
+
 string Engine::get_eval(void)
 {
    string s;
@@ -701,16 +1281,34 @@ void lstrip(string &s)
    s.erase(0, s.find_first_not_of(" \t\r\n"));
 }
 
-string get_first_token(const string &s, size_t pos)
+void rstrip(string_view &s)
+{
+   // if string is null terminated before the end of the string, truncate the string.
+   const char *nul = (const char *)memchr(s.data(), '\0', s.length());
+   if (nul != nullptr)
+      s = s.substr(0, nul - s.data());
+   // strip spaces/tabs/newlines/etc.
+   size_t end = s.find_last_not_of(" \t\r\n");
+   s = s.substr(0, (end == string_view::npos) ? 0 : (end + 1));
+}
+
+void lstrip(string_view &s)
+{
+   // strip spaces/tabs/newlines/etc.
+   size_t start = s.find_first_not_of(" \t\r\n");
+   s.remove_prefix((start == string_view::npos) ? s.length() : start);
+}
+
+string get_first_token(string_view s, size_t pos)
 {
    size_t start = s.find_first_not_of(" \t", pos);
    if (start == string::npos)
       return "";
    size_t end = s.find_first_of(" \t", start + 1);
-   return s.substr(start, (end == string::npos) ? string::npos : (end - start));
+   return string(s.substr(start, (end == string::npos) ? string::npos : (end - start)));
 }
 
-vector<string> get_tokens(const string &s)
+vector<string> get_tokens(string_view s)
 {
    vector<string> tokens;
    size_t start;
@@ -722,7 +1320,7 @@ vector<string> get_tokens(const string &s)
       if (start == string::npos)
          break;
       end = s.find_first_of(" \t", start + 1);
-      tokens.push_back(s.substr(start, (end == string::npos) ? string::npos : (end - start)));
+      tokens.emplace_back(s.substr(start, (end == string::npos) ? string::npos : (end - start)));
       if (end == string::npos)
          break;
    }
@@ -778,7 +1376,7 @@ player_color_4pc get_color_4pc_to_move_from_fen(const string &fen)
    return RED;
 }
 
-void convert_to_lowercase(const string &input_str, string &output_str)
+void convert_to_lowercase(string_view input_str, string &output_str)
 {
    output_str = input_str;
    for (auto &c : output_str)
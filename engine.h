@@ -3,19 +3,29 @@
 
 #define BOOST_PROCESS_VERSION 1
 
+#include "parser.h"
+#include "perfcounters.h"
+#include "debugring.h"
+#include "transcript.h"
 #include <boost/version.hpp>
 
 #if BOOST_VERSION >= 108800
 #include <boost/process/v1.hpp>
+#include <boost/process/v1/extend.hpp>
 #else
 #include <boost/process.hpp>
+#include <boost/process/extend.hpp>
 #endif
 
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <vector>
 #include <cctype>
+#include <cstring>
 #include <sstream>
+#include <atomic>
+#include <chrono>
 
 #define ABS(a)                (((a) > 0) ? (a) : (0 - (a)))
 
@@ -37,6 +47,28 @@ enum game_result
    ERROR_ENGINE_DISCONNECTED  // could not read data from engine
 };
 
+enum engine_event
+{
+   EVENT_NONE,                // engine hasn't finished what it is being waited on for
+   EVENT_STARTED,             // engine finished the startup handshake
+   EVENT_SETUP_DONE,          // engine finished new game setup
+   EVENT_READY,               // engine responded to "isready" / "ping" / "protover"
+   EVENT_MOVE,                // engine sent its move, or reported a game result
+   EVENT_DISCONNECTED         // could not read data from engine
+};
+
+enum engine_wait
+{
+   WAIT_NONE,                 // not waiting for anything. Engine output stays buffered until the next wait.
+   WAIT_UCIOK,                // UCI only: waiting for "uciok" during engine startup
+   WAIT_STARTUP_READY,        // waiting for engine to be ready after the startup commands (engine options)
+   WAIT_FEATURES,             // xboard only: waiting for "feature done=1" during engine startup
+   WAIT_SETUP_READY,          // waiting for engine to be ready during new game setup
+   WAIT_READY,                // waiting for engine to be ready, while checking its output for a game result
+   WAIT_MOVE,                 // waiting for engine's move
+   WAIT_MOVE_PART_2           // xboard only: waiting for the 2nd part of a multi-part move
+};
+
 enum player_color
 {
    WHITE,
@@ -57,13 +89,25 @@ enum engine_number
    SECOND
 };
 
+// Resource usage of an engine process, read from /proc (Linux only).
+struct process_stats
+{
+   int64_t cpu_ms;                  // user + system CPU time of all threads
+   int64_t rss_kb;                  // resident set size
+   int64_t peak_rss_kb;             // VmHWM
+   int64_t voluntary_switches;      // context switches of all threads, e.g. waiting for input or a lock
+   int64_t involuntary_switches;    // preempted by the scheduler, which rises when the machine is oversubscribed
+};
+
 void rstrip(string &s);
 void lstrip(string &s);
-string get_first_token(const string &s, size_t pos);
-vector<string> get_tokens(const string &s);
+void rstrip(string_view &s);
+void lstrip(string_view &s);
+string get_first_token(string_view s, size_t pos);
+vector<string> get_tokens(string_view s);
 player_color get_color_to_move_from_fen(const string &fen);
 player_color_4pc get_color_4pc_to_move_from_fen(const string &fen);
-void convert_to_lowercase(const string &input_str, string &output_str);
+void convert_to_lowercase(string_view input_str, string &output_str);
 
 class Engine
 {
@@ -78,16 +122,41 @@ public:
    bool m_quit_cmd_sent;
    bool m_resigned;
    bool m_offered_draw;
+   int64_t m_startup_time_ms;       // time from launching the engine until it completed the startup handshake, or -1
+   chrono::time_point<chrono::steady_clock> m_go_time;     // when the commands that start the engine's search were written to its stdin pipe
+   chrono::time_point<chrono::steady_clock> m_move_time;   // when the output with the engine's move was read from its stdout pipe
+   DebugRing *m_debug_ring;         // the game's I/O capture (--debug-failed), or nullptr
 
 private:
    bp::child *m_child_proc;
-   bp::opstream m_in_stream;
-   bp::ipstream m_out_stream;
+   int m_pidfd;                     // Linux: pidfd of the engine process (readable once it exits), or -1
+   atomic<bool> m_alive;            // cached result of is_running
+   bool m_exit_watched;             // true while the I/O reactor watches m_pidfd and keeps m_alive up to date
+   bp::pipe m_in_pipe;
+   bp::pipe m_out_pipe;
+   string m_tx_buf;                 // commands not yet written to the engine's stdin pipe
+   size_t m_tx_pos;                 // start of the unwritten part of m_tx_buf
+   size_t m_go_cmd_end;             // end of the commands that start the search in m_tx_buf, while they are not yet written
+   bool m_go_cmd_pending;
+   bool m_tx_batch;                 // if true, commands are queued in m_tx_buf until flush_engine_cmds is called
    game_result m_result;
-   string m_line;
+   string_view m_line;              // current line, in place in m_rx_buf. Only valid until more output is received.
+   string m_rx_buf;                 // engine output is read into this buffer in large chunks
+   size_t m_rx_pos;                 // start of output not yet consumed by readline
+   size_t m_rx_end;                 // end of output received so far
+   chrono::time_point<chrono::steady_clock> m_rx_time;     // when engine output was last read from the pipe
+   bool m_output_closed;
+   engine_wait m_wait;
    string m_opponent_move;
+   vector<int> m_cpu_set;           // CPUs the engine process is pinned to. Empty: not pinned.
+   string m_cgroup_path;            // cgroup v2 group the engine process runs in. Empty: the harness's cgroup.
+   PerfCounters m_perf;             // hardware performance counters of the engine process (--perf)
+   TranscriptWriter m_transcript;   // binary transcript of the engine's I/O (--transcript)
+   vector<string> m_startup_cmds;   // sent after "uciok" / xboard features, before the engine is first checked for readiness
+   chrono::time_point<chrono::steady_clock> m_launch_time;
    player_color m_color;
    int m_score;
+   search_info m_search_info;       // most recent search info reported by the engine in the current game
    bool m_xb_feature_ping;          // xboard only
    bool m_xb_feature_colors;        // xboard only
    bool m_xb_features_done;         // xboard only
@@ -96,6 +165,17 @@ private:
    bool m_xb_force_mode;            // xboard only
    bool m_debug;
 
+   // new game setup parameters, used when the engine becomes ready during new game setup
+   player_color m_setup_turn;
+   int64_t m_setup_start_time_ms;
+   int64_t m_setup_inc_time_ms;
+   int64_t m_setup_fixed_time_ms;
+   string m_setup_fen;
+   string m_setup_variant;
+
+   const size_t rx_chunk_size = 16384;    // minimum free space in m_rx_buf for each read from the pipe
+   const size_t rx_discard_size = 1 << 20;   // while nothing waits for the engine, complete lines beyond this are dropped
+   const size_t rx_max_size = 4 << 20;       // engine output buffered beyond this is an error
    const int mate_score = 100000;
    const int mate_score_neg = (0 - mate_score);
 
@@ -103,16 +183,31 @@ public:
    // functions
    Engine(void);
    ~Engine(void);
+   void set_cpu_affinity(const vector<int> &cpu_set);
+   const vector<int> &cpu_affinity(void);
+   void set_cgroup(const string &path);
+   const string &cgroup(void);
    int load_engine(const string &eng_file_name, int ID, engine_number engine_num, bool uci);
    void send_engine_cmd(const string &cmd);
+   void begin_cmd_batch(void);
+   void end_cmd_batch(void);
+   int flush_engine_cmds(void);
+   bool has_pending_cmds(void);
    void send_quit_cmd(void);
-   int get_engine_move(void);
-   int wait_for_ready(bool check_output);
-   int engine_new_game_setup(player_color color, player_color turn, int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms, const string &fen, const string &variant);
+   void add_startup_cmd(const string &cmd);
+   void engine_startup(void);
+   void request_move(void);
+   void wait_for_ready(void);
+   void engine_new_game_setup(player_color color, player_color turn, int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms, const string &fen, const string &variant);
    void engine_new_game_start(int64_t start_time_ms, int64_t inc_time_ms, int64_t fixed_time_ms);
-   void send_move_and_clocks_to_engine(const string &move, const string &startfen, const string &movelist, int64_t engine_clock_ms, int64_t opp_clock_ms, int64_t rtime, int64_t bltime, int64_t ytime, int64_t gtime, int64_t inc_ms, int64_t fixed_time_ms);
+   void send_move_and_clocks_to_engine(const string &move, const string &position_cmd, int64_t engine_clock_ms, int64_t opp_clock_ms, int64_t rtime, int64_t bltime, int64_t ytime, int64_t gtime, int64_t inc_ms, int64_t fixed_time_ms);
    void send_result_to_engine(game_result result);
    bool is_running(void);
+   bool sample_process_stats(process_stats &stats);
+   bool read_perf_counters(perf_counts &counts);
+   int exit_handle(void);
+   void set_exit_watched(bool watched);
+   void process_exited(void);
    void force_exit(void);
    bool has_checkmate(void);
    bool is_checkmated(void);
@@ -123,12 +218,32 @@ public:
    game_result get_game_result(void);
    void update_game_result(void);
    string get_eval(void);
+   int64_t get_reported_time_ms(void);
+   int64_t get_reported_nodes(void);
+   int64_t get_reported_nps(void);
    void xb_edit_board(const string &fen);
+   int input_handle(void);
+   int output_handle(void);
+   int read_output(char *buf, int size);
+   int receive_output(void);
+   void append_output(const char *data, size_t len);
+   void close_output(void);
+   bool is_output_closed(void);
+   engine_event process_output(void);
+   void cancel_wait(void);
 
 private:
+   bool reserve_output_space(void);
    int readline(void);
-   int get_features(void);
+   engine_event handle_line(void);
+   engine_event handle_feature_line(void);
+   void send_startup_cmds(void);
+   void send_ready_cmd(void);
+   bool is_ready_response(void);
+   void xb_new_game(void);
+   void finish_new_game_setup(void);
    void check_engine_output(void);
+   void update_search_info(const search_info &info);
 };
 
 struct options_info
@@ -141,10 +256,18 @@ struct options_info
    uint num_cores_2;
    uint mem_size_1;
    uint mem_size_2;
+   bool cpu_affinity;
+   bool cgroups;
+   bool perf_counters;
+   bool proc_stats;
+   uint nps_drop_percent;
+   bool nps_throttle;
    vector<string> custom_commands_1;
    vector<string> custom_commands_2;
    bool debug_1;
    bool debug_2;
+   uint debug_failed_kb;
+   string transcript_dir;
 
    bool print_moves;
    bool continue_on_error;
@@ -159,8 +282,10 @@ struct options_info
    uint tc_inc_ms;
    uint tc_fixed_time_move_ms;
    uint margin_ms;
+   uint setup_delay_ms;
    uint num_games_to_play;
    uint num_threads;
+   uint think_tokens;
    uint max_moves;
    string fens_filename;
    string variant;
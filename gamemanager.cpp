@@ -1,9 +1,24 @@
 #include "gamemanager.h"
 #include "logger.h"
 #include "simplechessmatch.h"
+#include "npsmonitor.h"
+#include "notifier.h"
 
 extern struct options_info options;
 
+// Clocks are kept in microseconds, and sent to engines in milliseconds.
+static int64_t to_ms(chrono::microseconds t)
+{
+   return chrono::duration_cast<chrono::milliseconds>(t).count();
+}
+
+static string us_to_ms_string(chrono::microseconds t)
+{
+   char s[32];
+   snprintf(s, sizeof(s), "%.3f", t.count() / 1000.0);
+   return s;
+}
+
 GameManager::GameManager(void)
 {
    m_turn = WHITE;
@@ -14,301 +29,672 @@ GameManager::GameManager(void)
    m_engine1_losses_on_time = 0;
    m_engine2_losses_on_time = 0;
    m_illegal_move_games = 0;
-   m_thread_running = false;
+   m_plies = 0;
+   m_engine1_overhead = { 0, 0, INT64_MIN };
+   m_engine2_overhead = { 0, 0, INT64_MIN };
+   m_game_running = false;
    m_swap_sides = false;
+   m_draw_agreed = false;
+   m_resignation = false;
    m_loss_on_time = false;
    m_repetition_draw = false;
    m_error = false;
    m_engine_disconnected = false;
+   m_engines_started = false;
+   m_think_tokens = 0;
+   m_turn_waited = false;
+   m_engine1_usage = { 0, 0, 0, 0, 0, 0, 0, 0 };
+   m_engine2_usage = { 0, 0, 0, 0, 0, 0, 0, 0 };
+   for (int e = 0; e < 2; e++)
+   {
+      perf_usage &perf = (e == 0) ? m_engine1_perf : m_engine2_perf;
+      perf.games = 0;
+      perf.nodes = 0;
+      for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+         perf.value[i] = -1;
+      m_game_start_stats_valid[e] = false;
+      m_game_stats_valid[e] = false;
+      m_game_start_perf_valid[e] = false;
+      m_game_perf_valid[e] = false;
+      m_think_us[e] = 0;
+      m_nodes[e] = 0;
+   }
+   m_go_engine_clock = nullptr;
+   m_go_opp_clock = nullptr;
+   if (options.debug_failed_kb != 0)
+   {
+      m_debug_ring.resize((size_t)options.debug_failed_kb * 1024);
+      m_engine1.m_debug_ring = &m_debug_ring;
+      m_engine2.m_debug_ring = &m_debug_ring;
+   }
    m_num_moves = 0;
    m_drawish_count = 0;
    
-   m_white_clock_ms = chrono::milliseconds(0);
-   m_black_clock_ms = chrono::milliseconds(0);
-   m_red_clock_ms = chrono::milliseconds(0);
-   m_blue_clock_ms = chrono::milliseconds(0);
-   m_yellow_clock_ms = chrono::milliseconds(0);
-   m_green_clock_ms = chrono::milliseconds(0);
-
-   m_pgn_valid = false;
+   m_white_clock_us = chrono::microseconds(0);
+   m_black_clock_us = chrono::microseconds(0);
+   m_red_clock_us = chrono::microseconds(0);
+   m_blue_clock_us = chrono::microseconds(0);
+   m_yellow_clock_us = chrono::microseconds(0);
+   m_green_clock_us = chrono::microseconds(0);
+
    m_move_list.reserve(1000);
+   m_position_cmd.reserve(4000);
 
-   m_final_result = UNFINISHED;
    m_pair_id = 0;
+
+   m_state = GAME_IDLE;
+   m_white_engine = &m_engine1;
+   m_black_engine = &m_engine2;
+   m_finish_step = 0;
+   m_setup_pending = 0;
+   m_game_end_time_valid = false;
+   m_timer_armed = false;
+   m_start_time_ms = chrono::milliseconds(0);
+   m_increment_ms = chrono::milliseconds(0);
+   m_fixed_time_ms = chrono::milliseconds(0);
 }
 
 GameManager::~GameManager(void)
 {
 }
 
-void GameManager::game_runner(void)
+// Called on the reactor thread when the reactor starts. The startup handshakes of all engines run in parallel.
+void GameManager::start_engines(void)
+{
+   m_state = GAME_ENGINE_STARTUP;
+   m_engine1.engine_startup();
+   m_engine2.engine_startup();
+}
+
+// Called by MatchManager to collect a completed game. Returns false if there is none.
+bool GameManager::collect_finished_game(finished_game &game)
 {
-   game_result result;
+   lock_guard<mutex> lock(m_finished_mutex);
+   if (m_finished_games.empty())
+      return false;
+   game = move(m_finished_games.front());
+   m_finished_games.pop_front();
+   return true;
+}
+
+// The engines are running, and the match isn't ending, so a new game can be started.
+bool GameManager::can_start_game(void)
+{
+   return m_engines_started && !m_engine_disconnected && !m_engine1.m_quit_cmd_sent && !m_engine2.m_quit_cmd_sent && (options.continue_on_error || !m_error);
+}
 
+// Called on the reactor thread to start a queued game while the game slot is idle.
+void GameManager::start_game(const game_assignment &game)
+{
+   m_game_running = true;
+   send_new_game_setup(game);
+   begin_game(game);
+}
+
+// Send new game setup to both engines, which are set up at the same time. The first move waits only for their "readyok" / "pong".
+// This uses only the new game's assignment, so that it can be sent while the previous game is still being finalized.
+void GameManager::send_new_game_setup(const game_assignment &game)
+{
+   Engine *white_engine = game.swap_sides ? &m_engine2 : &m_engine1;
+   Engine *black_engine = game.swap_sides ? &m_engine1 : &m_engine2;
+   player_color turn = get_color_to_move_from_fen(game.fen);
+
+   m_debug_ring.clear();
+   m_setup_pending = 2;
+   white_engine->engine_new_game_setup(WHITE, turn, options.tc_ms, options.tc_inc_ms, options.tc_fixed_time_move_ms, game.fen, options.variant);
+   black_engine->engine_new_game_setup(BLACK, turn, options.tc_ms, options.tc_inc_ms, options.tc_fixed_time_move_ms, game.fen, options.variant);
+}
+
+// Start the game once its setup has been sent to the engines. Continued on EVENT_SETUP_DONE from both engines.
+void GameManager::begin_game(const game_assignment &game)
+{
+   m_fen = game.fen;
+   m_swap_sides = game.swap_sides;
+   m_pair_id = game.pair_id;
    m_timestamp = chrono::steady_clock::now();
    m_loss_on_time = false;
    m_repetition_draw = false;
-   m_thread_running = true;
    m_num_moves = 0;
    m_drawish_count = 0;
    m_move_list = "";
    m_move_vector.clear();
-
-   result = run_engine_game(chrono::milliseconds(options.tc_ms), chrono::milliseconds(options.tc_inc_ms),
-                            chrono::milliseconds(options.tc_fixed_time_move_ms));
-
-   if (m_num_moves > 0)
-      store_pgn(result, m_swap_sides ? m_engine2.m_file_name : m_engine1.m_file_name, m_swap_sides ? m_engine1.m_file_name : m_engine2.m_file_name,
-                chrono::milliseconds(options.tc_ms), chrono::milliseconds(options.tc_inc_ms), chrono::milliseconds(options.tc_fixed_time_move_ms));
-
-   if (result == ERROR_ENGINE_DISCONNECTED)
-      m_engine_disconnected = true;
-   else if (result == ERROR_ILLEGAL_MOVE)
-      m_illegal_move_games++;
-   else if (((result == WHITE_WIN) && !m_swap_sides) || ((result == BLACK_WIN) && m_swap_sides))
-   {
-      m_engine1_wins++;
-      if (m_loss_on_time)
-         m_engine2_losses_on_time++;
-   }
-   else if (((result == BLACK_WIN) && !m_swap_sides) || ((result == WHITE_WIN) && m_swap_sides))
-   {
-      m_engine2_wins++;
-      if (m_loss_on_time)
-         m_engine1_losses_on_time++;
-   }
-   else if (result == DRAW)
-      m_draws++;
-
-   if ((result == ERROR_ILLEGAL_MOVE) || (result == ERROR_INVALID_POSITION) || (result == UNDETERMINED))
+   m_game_start_stats_valid[0] = options.proc_stats && m_engine1.sample_process_stats(m_game_start_stats[0]);
+   m_game_start_stats_valid[1] = options.proc_stats && m_engine2.sample_process_stats(m_game_start_stats[1]);
+   m_game_stats_valid[0] = false;
+   m_game_stats_valid[1] = false;
+   m_think_us[0] = 0;
+   m_think_us[1] = 0;
+   m_nodes[0] = 0;
+   m_nodes[1] = 0;
+   m_game_start_perf_valid[0] = m_engine1.read_perf_counters(m_game_start_perf[0]);
+   m_game_start_perf_valid[1] = m_engine2.read_perf_counters(m_game_start_perf[1]);
+   m_game_perf_valid[0] = false;
+   m_game_perf_valid[1] = false;
+   if (m_fen.empty())
+      m_position_cmd = "position startpos moves ";
+   else
    {
-      log_event("Game Error: FEN: " + m_fen + " | Moves: " + m_move_list);
-      if (m_num_moves > 0)
-         log_event("PGN:\n" + m_pgn);
+      m_position_cmd = "position fen ";
+      m_position_cmd.append(m_fen);
+      m_position_cmd.append(" moves ");
    }
 
-   m_final_result = result;
-
-   m_thread_running = false;
-}
-
-game_result GameManager::run_engine_game(chrono::milliseconds start_time_ms, chrono::milliseconds increment_ms, chrono::milliseconds fixed_time_ms)
-{
-   chrono::milliseconds elapsed_time_ms;
-   game_result result = UNFINISHED;
-   Engine *white_engine;
-   Engine *black_engine;
+   m_start_time_ms = chrono::milliseconds(options.tc_ms);
+   m_increment_ms = chrono::milliseconds(options.tc_inc_ms);
+   m_fixed_time_ms = chrono::milliseconds(options.tc_fixed_time_move_ms);
 
    if (m_swap_sides)
    {
-      white_engine = &m_engine2;
-      black_engine = &m_engine1;
+      m_white_engine = &m_engine2;
+      m_black_engine = &m_engine1;
    }
    else
    {
-      white_engine = &m_engine1;
-      black_engine = &m_engine2;
+      m_white_engine = &m_engine1;
+      m_black_engine = &m_engine2;
    }
 
-   if (fixed_time_ms.count())
+   if (m_fixed_time_ms.count())
    {
-      m_white_clock_ms = fixed_time_ms;
-      m_black_clock_ms = fixed_time_ms;
-      m_red_clock_ms = fixed_time_ms;
-      m_blue_clock_ms = fixed_time_ms;
-      m_yellow_clock_ms = fixed_time_ms;
-      m_green_clock_ms = fixed_time_ms;
+      m_white_clock_us = m_fixed_time_ms;
+      m_black_clock_us = m_fixed_time_ms;
+      m_red_clock_us = m_fixed_time_ms;
+      m_blue_clock_us = m_fixed_time_ms;
+      m_yellow_clock_us = m_fixed_time_ms;
+      m_green_clock_us = m_fixed_time_ms;
    }
    else
    {
-      m_white_clock_ms = start_time_ms;
-      m_black_clock_ms = start_time_ms;
-      m_red_clock_ms = start_time_ms;
-      m_blue_clock_ms = start_time_ms;
-      m_yellow_clock_ms = start_time_ms;
-      m_green_clock_ms = start_time_ms;
+      m_white_clock_us = m_start_time_ms;
+      m_black_clock_us = m_start_time_ms;
+      m_red_clock_us = m_start_time_ms;
+      m_blue_clock_us = m_start_time_ms;
+      m_yellow_clock_us = m_start_time_ms;
+      m_green_clock_us = m_start_time_ms;
    }
 
-   this_thread::sleep_for(100ms);
-
    m_turn = get_color_to_move_from_fen(m_fen);
-
    if (options.fourplayerchess)
       m_turn_4pc = get_color_4pc_to_move_from_fen(m_fen);
    else
       m_turn_4pc = (m_turn == WHITE) ? RED : BLUE;
 
-   if (white_engine->engine_new_game_setup(WHITE, m_turn, start_time_ms.count(), increment_ms.count(), fixed_time_ms.count(), m_fen, options.variant) == 0)
-   {
-      if (!white_engine->m_quit_cmd_sent)
-         log_event("Error: " + white_engine->m_name + " could not start a new game.");
-      return ERROR_ENGINE_DISCONNECTED;
-   }
-   if (black_engine->engine_new_game_setup(BLACK, m_turn, start_time_ms.count(), increment_ms.count(), fixed_time_ms.count(), m_fen, options.variant) == 0)
+   m_state = GAME_SETUP;
+}
+
+void GameManager::arm_timer(chrono::milliseconds delay)
+{
+   m_timer_deadline = chrono::steady_clock::now() + delay;
+   m_timer_armed = true;
+}
+
+// Called on the reactor thread when the timer armed by arm_timer expires.
+void GameManager::timer_expired(void)
+{
+   m_timer_armed = false;
+
+   if (m_state == GAME_SETUP_DELAY)
    {
-      if (!black_engine->m_quit_cmd_sent)
-         log_event("Error: " + black_engine->m_name + " could not start a new game.");
-      return ERROR_ENGINE_DISCONNECTED;
+      m_state = GAME_PLAYING;
+      next_turn();
    }
+}
 
-   this_thread::sleep_for(100ms);
+// Called on the reactor thread when the CPU think tokens requested by start_turn have been granted.
+void GameManager::think_tokens_granted(void)
+{
+   if (m_state == GAME_THINK_WAIT)
+      send_go();
+}
 
-   if (m_turn == WHITE)
-      white_engine->engine_new_game_start(start_time_ms.count(), increment_ms.count(), fixed_time_ms.count());
-   else
-      black_engine->engine_new_game_start(start_time_ms.count(), increment_ms.count(), fixed_time_ms.count());
+// Called on the reactor thread whenever new output from either engine has been received, or a wait has been started.
+void GameManager::service_engines(void)
+{
+   bool progress = true;
 
-   m_timestamp = chrono::steady_clock::now();
+   while (progress && (m_state != GAME_IDLE))
+   {
+      progress = false;
+      engine_event event = m_engine1.process_output();
+      if (event != EVENT_NONE)
+      {
+         handle_engine_event(&m_engine1, event);
+         progress = true;
+      }
+      event = m_engine2.process_output();
+      if (event != EVENT_NONE)
+      {
+         handle_engine_event(&m_engine2, event);
+         progress = true;
+      }
+   }
+}
 
-   while ((white_engine->get_game_result() == UNFINISHED) && (black_engine->get_game_result() == UNFINISHED) && (m_num_moves < options.max_moves))
+void GameManager::handle_engine_event(Engine *engine, engine_event event)
+{
+   if (m_state == GAME_ENGINE_STARTUP)
    {
-      game_result adjudicate_result = check_for_adjudication(white_engine, black_engine);
-      if (adjudicate_result != UNFINISHED)
+      if (event == EVENT_DISCONNECTED)
+      {
+         if (!engine->m_quit_cmd_sent)
+            log_event("Error: " + engine->m_name + " (" + to_string(engine->m_ID) + ") exited during startup.");
+         m_engine1.cancel_wait();
+         m_engine2.cancel_wait();
+         m_state = GAME_IDLE;
+         m_engine_disconnected = true;
+         g_main_notifier.notify();
+      }
+      else if ((event == EVENT_STARTED) && (m_engine1.m_startup_time_ms >= 0) && (m_engine2.m_startup_time_ms >= 0))
       {
-         result = adjudicate_result;
-         break;
+         m_state = GAME_IDLE;
+         m_engines_started = true;
+         g_main_notifier.notify();
       }
+      return;
+   }
 
-      chrono::milliseconds *current_clock_ptr;
-      chrono::milliseconds *next_clock_ptr;
-      string color_name;
+   if (event == EVENT_DISCONNECTED)
+   {
+      if (m_state == GAME_FINISHING)
+      {
+         check_remaining_output();
+         return;
+      }
+      if (!engine->m_quit_cmd_sent)
+      {
+         if ((m_state == GAME_PLAYING) || (m_state == GAME_THINK_WAIT))
+            log_event("Error: " + engine->m_name + " disconnected.");
+         else
+            log_event("Error: " + engine->m_name + " could not start a new game.");
+      }
+      game_completed(ERROR_ENGINE_DISCONNECTED);
+      return;
+   }
 
-      if (options.fourplayerchess && !options.legacy_clocks)
+   if ((m_state == GAME_SETUP) && (event == EVENT_SETUP_DONE))
+   {
+      if (--m_setup_pending != 0)
+         return;
+      if (options.setup_delay_ms != 0)
       {
-         if (m_turn_4pc == RED) { current_clock_ptr = &m_red_clock_ms; next_clock_ptr = &m_blue_clock_ms; color_name = "red"; }
-         else if (m_turn_4pc == BLUE) { current_clock_ptr = &m_blue_clock_ms; next_clock_ptr = &m_yellow_clock_ms; color_name = "blue"; }
-         else if (m_turn_4pc == YELLOW) { current_clock_ptr = &m_yellow_clock_ms; next_clock_ptr = &m_green_clock_ms; color_name = "yellow"; }
-         else { current_clock_ptr = &m_green_clock_ms; next_clock_ptr = &m_red_clock_ms; color_name = "green"; }
+         m_state = GAME_SETUP_DELAY;
+         arm_timer(chrono::milliseconds(options.setup_delay_ms));
       }
       else
       {
-         // Standard chess, or 4PC with legacy clocks
-         if (options.fourplayerchess)
-         {
-            if (m_turn_4pc == RED) { current_clock_ptr = &m_white_clock_ms; next_clock_ptr = &m_black_clock_ms; color_name = "red"; }
-            else if (m_turn_4pc == BLUE) { current_clock_ptr = &m_black_clock_ms; next_clock_ptr = &m_white_clock_ms; color_name = "blue"; }
-            else if (m_turn_4pc == YELLOW) { current_clock_ptr = &m_white_clock_ms; next_clock_ptr = &m_black_clock_ms; color_name = "yellow"; }
-            else { current_clock_ptr = &m_black_clock_ms; next_clock_ptr = &m_white_clock_ms; color_name = "green"; }
-         }
-         else
-         {
-            if (m_turn == WHITE) { current_clock_ptr = &m_white_clock_ms; next_clock_ptr = &m_black_clock_ms; color_name = "white"; }
-            else { current_clock_ptr = &m_black_clock_ms; next_clock_ptr = &m_white_clock_ms; color_name = "black"; }
-         }
+         m_state = GAME_PLAYING;
+         next_turn();
       }
+   }
+   else if ((m_state == GAME_PLAYING) && (event == EVENT_MOVE))
+      engine_moved(engine);
+   else if ((m_state == GAME_FINISHING) && (event == EVENT_READY))
+      check_remaining_output();
+}
 
-      if (m_turn == WHITE)
+void GameManager::select_clocks(chrono::microseconds **current_clock_ptr, chrono::microseconds **next_clock_ptr, string &color_name)
+{
+   if (options.fourplayerchess && !options.legacy_clocks)
+   {
+      if (m_turn_4pc == RED) { *current_clock_ptr = &m_red_clock_us; *next_clock_ptr = &m_blue_clock_us; color_name = "red"; }
+      else if (m_turn_4pc == BLUE) { *current_clock_ptr = &m_blue_clock_us; *next_clock_ptr = &m_yellow_clock_us; color_name = "blue"; }
+      else if (m_turn_4pc == YELLOW) { *current_clock_ptr = &m_yellow_clock_us; *next_clock_ptr = &m_green_clock_us; color_name = "yellow"; }
+      else { *current_clock_ptr = &m_green_clock_us; *next_clock_ptr = &m_red_clock_us; color_name = "green"; }
+   }
+   else
+   {
+      // Standard chess, or 4PC with legacy clocks
+      if (options.fourplayerchess)
       {
-         if (!white_engine->get_engine_move())
-         {
-            if (!white_engine->m_quit_cmd_sent)
-               log_event("Error: " + white_engine->m_name + " disconnected.");
-            return ERROR_ENGINE_DISCONNECTED;
-         }
-         if (white_engine->m_move.empty())
-            break; // no legal moves
-
-         elapsed_time_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_timestamp);
-         *current_clock_ptr = *current_clock_ptr - elapsed_time_ms;
-
-         if (current_clock_ptr->count() < (0 - (int)options.margin_ms))
-         {
-            log_event(white_engine->m_name + " (" + color_name + ") ran out of time. " + to_string(current_clock_ptr->count()) + " ms");
-            m_loss_on_time = true;
-            result = BLACK_WIN;
-            break;
-         }
-         *current_clock_ptr = (fixed_time_ms.count() ? (fixed_time_ms) : (*current_clock_ptr + increment_ms));
-
-         convert_move_to_standard_engine_format(white_engine->m_move);
-         move_played(white_engine->m_move);
-
-         black_engine->send_move_and_clocks_to_engine(white_engine->m_move, m_fen, m_move_list, 
-                                                      next_clock_ptr->count(), current_clock_ptr->count(), 
-                                                      m_red_clock_ms.count(), m_blue_clock_ms.count(), m_yellow_clock_ms.count(), m_green_clock_ms.count(), 
-                                                      increment_ms.count(), fixed_time_ms.count());
-         
-         m_timestamp = chrono::steady_clock::now();
-         if (options.print_moves)
-            log_move(color_name + " moved: " + white_engine->m_move + ",   elapsed: " + to_string(elapsed_time_ms.count()) + " ms,   clock: "
-                     + to_string(current_clock_ptr->count()) + " ms,  eval: " + white_engine->get_eval());
+         if (m_turn_4pc == RED) { *current_clock_ptr = &m_white_clock_us; *next_clock_ptr = &m_black_clock_us; color_name = "red"; }
+         else if (m_turn_4pc == BLUE) { *current_clock_ptr = &m_black_clock_us; *next_clock_ptr = &m_white_clock_us; color_name = "blue"; }
+         else if (m_turn_4pc == YELLOW) { *current_clock_ptr = &m_white_clock_us; *next_clock_ptr = &m_black_clock_us; color_name = "yellow"; }
+         else { *current_clock_ptr = &m_black_clock_us; *next_clock_ptr = &m_white_clock_us; color_name = "green"; }
       }
       else
       {
-         if (!black_engine->get_engine_move())
-         {
-            if (!black_engine->m_quit_cmd_sent)
-               log_event("Error: " + black_engine->m_name + " disconnected.");
-            return ERROR_ENGINE_DISCONNECTED;
-         }
-         if (black_engine->m_move.empty())
-            break; // no legal moves
-
-         elapsed_time_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_timestamp);
-         *current_clock_ptr = *current_clock_ptr - elapsed_time_ms;
-
-         if (current_clock_ptr->count() < (0 - (int)options.margin_ms))
-         {
-            log_event(black_engine->m_name + " (" + color_name + ") ran out of time. " + to_string(current_clock_ptr->count()) + " ms");
-            m_loss_on_time = true;
-            result = WHITE_WIN;
-            break;
-         }
-         *current_clock_ptr = (fixed_time_ms.count() ? (fixed_time_ms) : (*current_clock_ptr + increment_ms));
-
-         convert_move_to_standard_engine_format(black_engine->m_move);
-         move_played(black_engine->m_move);
-
-         white_engine->send_move_and_clocks_to_engine(black_engine->m_move, m_fen, m_move_list, 
-                                                      next_clock_ptr->count(), current_clock_ptr->count(), 
-                                                      m_red_clock_ms.count(), m_blue_clock_ms.count(), m_yellow_clock_ms.count(), m_green_clock_ms.count(), 
-                                                      increment_ms.count(), fixed_time_ms.count());
-
-         m_timestamp = chrono::steady_clock::now();
-         if (options.print_moves)
-            log_move(color_name + " moved: " + black_engine->m_move + ",   elapsed: " + to_string(elapsed_time_ms.count()) + " ms,   clock: "
-                     + to_string(current_clock_ptr->count()) + " ms,  eval: " + black_engine->get_eval());
+         if (m_turn == WHITE) { *current_clock_ptr = &m_white_clock_us; *next_clock_ptr = &m_black_clock_us; color_name = "white"; }
+         else { *current_clock_ptr = &m_black_clock_us; *next_clock_ptr = &m_white_clock_us; color_name = "black"; }
       }
+   }
+}
+
+// Start waiting for the next move, unless the game is over.
+void GameManager::next_turn(void)
+{
+   if ((m_white_engine->get_game_result() != UNFINISHED) || (m_black_engine->get_game_result() != UNFINISHED) || (m_num_moves >= options.max_moves))
+   {
+      conclude_game(UNFINISHED);
+      return;
+   }
 
-      m_turn_4pc = options.fourplayerchess ? static_cast<player_color_4pc>((m_turn_4pc + 1) % 4) : static_cast<player_color_4pc>((m_turn_4pc + 1) % 2);
-      m_turn = (m_turn == WHITE) ? BLACK : WHITE;
+   chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+   game_result adjudicate_result = check_for_adjudication(m_white_engine, m_black_engine);
+   m_latency.adjudication.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+   if (adjudicate_result != UNFINISHED)
+   {
+      conclude_game(adjudicate_result);
+      return;
    }
 
+   start_turn();
+}
+
+// The engine to move is sent its opponent's move and "go" once it has enough CPU think tokens (--tokens).
+// Its clock doesn't start running until then.
+void GameManager::start_turn(void)
+{
+   Engine *engine = (m_turn == WHITE) ? m_white_engine : m_black_engine;
+   uint tokens = (engine->m_number == FIRST) ? options.num_cores_1 : options.num_cores_2;
+
+   m_turn_waited = !g_reactor.acquire_think_tokens(this, max(tokens, 1u));
+   if (m_turn_waited)
+      m_state = GAME_THINK_WAIT;
+   else
+      send_go();
+}
+
+void GameManager::send_go(void)
+{
+   Engine *engine = (m_turn == WHITE) ? m_white_engine : m_black_engine;
+
+   if (m_num_moves == 0)
+      engine->engine_new_game_start(m_start_time_ms.count(), m_increment_ms.count(), m_fixed_time_ms.count());
+   else
+      engine->send_move_and_clocks_to_engine(m_move_vector.back(), m_position_cmd, 
+                                             to_ms(*m_go_engine_clock), to_ms(*m_go_opp_clock), 
+                                             to_ms(m_red_clock_us), to_ms(m_blue_clock_us), to_ms(m_yellow_clock_us), to_ms(m_green_clock_us), 
+                                             m_increment_ms.count(), m_fixed_time_ms.count());
+
+   m_timestamp = chrono::steady_clock::now();
+   m_state = GAME_PLAYING;
+   engine->request_move();
+}
+
+void GameManager::engine_moved(Engine *engine)
+{
+   chrono::microseconds elapsed_time;
+   chrono::microseconds *current_clock_ptr;
+   chrono::microseconds *next_clock_ptr;
+   string color_name;
+
+   g_reactor.release_think_tokens(this);
+
+   if (engine->m_move.empty())
+   {
+      conclude_game(UNFINISHED); // no legal moves
+      return;
+   }
+
+   select_clocks(&current_clock_ptr, &next_clock_ptr, color_name);
+
+   if ((m_num_moves > 0) && !m_turn_waited)
+      m_latency.turnaround.record(chrono::duration_cast<chrono::microseconds>(engine->m_go_time - m_last_move_time).count());
+   else if ((m_num_moves == 0) && m_game_end_time_valid)
+      m_latency.turnover.record(chrono::duration_cast<chrono::microseconds>(engine->m_go_time - m_game_end_time).count());
+   m_last_move_time = engine->m_move_time;
+
+   // the engine's time runs from writing "go" to its pipe until reading its move from the pipe, so that the harness's own work isn't charged to it.
+   elapsed_time = max(chrono::duration_cast<chrono::microseconds>(engine->m_move_time - engine->m_go_time), chrono::microseconds(0));
+   *current_clock_ptr = *current_clock_ptr - elapsed_time;
+   m_think_us[(engine->m_number == FIRST) ? 0 : 1] += elapsed_time.count();
+   m_nodes[(engine->m_number == FIRST) ? 0 : 1] += max(engine->get_reported_nodes(), (int64_t)0);
+   if (options.nps_drop_percent != 0)
+      g_nps_monitor.record((engine->m_number == FIRST) ? 0 : 1, engine->get_reported_nps(), to_ms(elapsed_time));
+
+   int64_t reported_ms = engine->get_reported_time_ms();
+   string reported_str = (reported_ms >= 0) ? (to_string(reported_ms) + " ms") : "n/a";
+   if (reported_ms >= 0)
+   {
+      clock_overhead &overhead = (engine->m_number == FIRST) ? m_engine1_overhead : m_engine2_overhead;
+      int64_t overhead_us = elapsed_time.count() - (reported_ms * 1000);
+      overhead.moves++;
+      overhead.total_us += overhead_us;
+      overhead.max_us = max(overhead.max_us, overhead_us);
+   }
+
+   if (*current_clock_ptr < -chrono::milliseconds(options.margin_ms))
+   {
+      log_event(engine->m_name + " (" + color_name + ") ran out of time. " + us_to_ms_string(*current_clock_ptr) + " ms. Move time "
+                + us_to_ms_string(elapsed_time) + " ms, engine reported " + reported_str);
+      m_loss_on_time = true;
+      conclude_game((engine == m_white_engine) ? BLACK_WIN : WHITE_WIN);
+      return;
+   }
+   *current_clock_ptr = (m_fixed_time_ms.count() ? chrono::microseconds(m_fixed_time_ms) : (*current_clock_ptr + m_increment_ms));
+
+   chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+   convert_move_to_standard_engine_format(engine->m_move);
+   move_played(engine->m_move);
+   m_latency.move_played.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+
+   m_go_engine_clock = next_clock_ptr;
+   m_go_opp_clock = current_clock_ptr;
+
+   if (options.print_moves)
+   {
+      start = chrono::steady_clock::now();
+      log_move(color_name + " moved: " + engine->m_move + ",   elapsed: " + us_to_ms_string(elapsed_time) + " ms (engine: " + reported_str + "),   clock: "
+               + us_to_ms_string(*current_clock_ptr) + " ms,  eval: " + engine->get_eval());
+      m_latency.logging.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+   }
+
+   m_turn_4pc = options.fourplayerchess ? static_cast<player_color_4pc>((m_turn_4pc + 1) % 4) : static_cast<player_color_4pc>((m_turn_4pc + 1) % 2);
+   m_turn = (m_turn == WHITE) ? BLACK : WHITE;
+
+   next_turn();
+}
+
+// Game play is over. If the result isn't known yet, check the remaining engine output before determining it.
+void GameManager::conclude_game(game_result result)
+{
    if (result == UNFINISHED)
    {
-      // In case there is unread data (which may contain game result) from engine where result isn't known yet:
-      if (white_engine->get_game_result() == UNFINISHED)
-         white_engine->wait_for_ready(true);
-      if (black_engine->get_game_result() == UNFINISHED)
-         black_engine->wait_for_ready(true);
+      m_state = GAME_FINISHING;
+      m_finish_step = 0;
+      check_remaining_output();
+      return;
+   }
+
+   m_white_engine->send_result_to_engine(result);
+   m_black_engine->send_result_to_engine(result);
+   game_completed(result);
+}
 
-      result = determine_game_result(white_engine, black_engine);
+void GameManager::check_remaining_output(void)
+{
+   // In case there is unread data (which may contain game result) from engine where result isn't known yet:
+   while (m_finish_step < 2)
+   {
+      Engine *engine = (m_finish_step == 0) ? m_white_engine : m_black_engine;
+      m_finish_step++;
+      if (engine->get_game_result() == UNFINISHED)
+      {
+         engine->wait_for_ready();
+         return; // continued on EVENT_READY
+      }
    }
 
-   white_engine->send_result_to_engine(result);
-   black_engine->send_result_to_engine(result);
+   game_result result = determine_game_result(m_white_engine, m_black_engine);
 
-   return result;
+   m_white_engine->send_result_to_engine(result);
+   m_black_engine->send_result_to_engine(result);
+   game_completed(result);
+}
+
+void GameManager::game_completed(game_result result)
+{
+   g_reactor.release_think_tokens(this);
+   m_engine1.cancel_wait();
+   m_engine2.cancel_wait();
+   m_timer_armed = false;
+   m_state = GAME_IDLE;
+   m_game_end_time = chrono::steady_clock::now();
+   m_game_end_time_valid = true;
+
+   // saved before the next game's setup resets the engines' flags
+   m_draw_agreed = m_engine1.m_offered_draw && m_engine2.m_offered_draw;
+   m_resignation = m_engine1.m_resigned || m_engine2.m_resigned;
+
+   // a disconnect after the engines were told to quit is the match ending, not a failure.
+   if (m_debug_ring.is_enabled() && ((result == ERROR_ILLEGAL_MOVE) || (result == ERROR_INVALID_POSITION) || (result == UNDETERMINED) || m_loss_on_time
+       || ((result == ERROR_ENGINE_DISCONNECTED) && !m_engine1.m_quit_cmd_sent && !m_engine2.m_quit_cmd_sent)))
+      dump_debug_ring(result);
+
+   // If another game is queued, the slot continues with it: its setup is written to the engines right away, so that they
+   // process "ucinewgame" and answer "readyok" while the PGN and statistics of this game are done.
+   game_assignment next_game;
+   bool next_game_started = false;
+   if ((result != ERROR_ENGINE_DISCONNECTED) && can_start_game())
+      next_game_started = g_reactor.take_queued_game(next_game);
+   if (next_game_started)
+   {
+      send_new_game_setup(next_game);
+      g_reactor.flush_engine_cmds(this);
+   }
+
+   // after the next setup is sent, so that --proc and --perf sampling doesn't delay it. The engines' setup work is counted in this game.
+   update_engine_usage();
+
+   m_plies += m_num_moves;
+   if (m_num_moves > 0)
+      store_pgn(result, m_swap_sides ? m_engine2.m_file_name : m_engine1.m_file_name, m_swap_sides ? m_engine1.m_file_name : m_engine2.m_file_name,
+                m_start_time_ms, m_increment_ms, m_fixed_time_ms);
+
+   if (result == ERROR_ENGINE_DISCONNECTED)
+      m_engine_disconnected = true;
+   else if (result == ERROR_ILLEGAL_MOVE)
+      m_illegal_move_games++;
+   else if (((result == WHITE_WIN) && !m_swap_sides) || ((result == BLACK_WIN) && m_swap_sides))
+   {
+      m_engine1_wins++;
+      if (m_loss_on_time)
+         m_engine2_losses_on_time++;
+   }
+   else if (((result == BLACK_WIN) && !m_swap_sides) || ((result == WHITE_WIN) && m_swap_sides))
+   {
+      m_engine2_wins++;
+      if (m_loss_on_time)
+         m_engine1_losses_on_time++;
+   }
+   else if (result == DRAW)
+      m_draws++;
+
+   if ((result == ERROR_ILLEGAL_MOVE) || (result == ERROR_INVALID_POSITION) || (result == UNDETERMINED))
+   {
+      log_event("Game Error: FEN: " + m_fen + " | Moves: " + m_move_list);
+      if (m_num_moves > 0)
+         log_event("PGN:\n" + m_pgn);
+   }
+
+   finished_game game;
+   game.result = result;
+   game.swap_sides = m_swap_sides;
+   game.pair_id = m_pair_id;
+   if (m_num_moves > 0)
+      game.pgn.swap(m_pgn);
+   {
+      lock_guard<mutex> lock(m_finished_mutex);
+      m_finished_games.push_back(move(game));
+   }
+
+   // the game is handed over before m_game_running is cleared, so that MatchManager collects it before it sees the slot idle.
+   if (next_game_started)
+      begin_game(next_game);
+   else
+      m_game_running = false;
+   g_main_notifier.notify();
+}
+
+// Write the engine I/O of a failed game to debug_failed.log (--debug-failed).
+void GameManager::dump_debug_ring(game_result result)
+{
+   string reason;
+   if (result == ERROR_ILLEGAL_MOVE)
+      reason = "illegal move";
+   else if (result == ERROR_INVALID_POSITION)
+      reason = "invalid position";
+   else if (result == UNDETERMINED)
+      reason = "undetermined result";
+   else if (result == ERROR_ENGINE_DISCONNECTED)
+      reason = "engine disconnected";
+   else
+      reason = "loss on time";
+
+   log_failed_game("=== Failed game (" + reason + "): White " + m_white_engine->m_name + " (" + to_string(m_white_engine->m_ID) + "), Black "
+                   + m_black_engine->m_name + " (" + to_string(m_black_engine->m_ID) + ")\nFEN: " + (m_fen.empty() ? "startpos" : m_fen)
+                   + " | Moves: " + m_move_list + "\n" + m_debug_ring.contents());
+}
+
+// Sample both engines' process stats at the end of a game, and add their usage during the game to the slot totals.
+void GameManager::update_engine_usage(void)
+{
+   for (int e = 0; e < 2; e++)
+   {
+      Engine *engine = (e == 0) ? &m_engine1 : &m_engine2;
+      engine_usage &usage = (e == 0) ? m_engine1_usage : m_engine2_usage;
+      process_stats end_stats;
+
+      m_game_stats_valid[e] = m_game_start_stats_valid[e] && engine->sample_process_stats(end_stats);
+      if (!m_game_stats_valid[e])
+         continue;
+      m_game_stats[e].cpu_ms = end_stats.cpu_ms - m_game_start_stats[e].cpu_ms;
+      m_game_stats[e].rss_kb = end_stats.rss_kb;
+      m_game_stats[e].peak_rss_kb = end_stats.peak_rss_kb;
+      m_game_stats[e].voluntary_switches = end_stats.voluntary_switches - m_game_start_stats[e].voluntary_switches;
+      m_game_stats[e].involuntary_switches = end_stats.involuntary_switches - m_game_start_stats[e].involuntary_switches;
+
+      if (usage.games == 0)
+         usage.first_rss_kb = end_stats.rss_kb;
+      usage.games++;
+      usage.cpu_ms += m_game_stats[e].cpu_ms;
+      usage.think_ms += m_think_us[e] / 1000;
+      usage.voluntary_switches += m_game_stats[e].voluntary_switches;
+      usage.involuntary_switches += m_game_stats[e].involuntary_switches;
+      usage.rss_kb = end_stats.rss_kb;
+      usage.peak_rss_kb = max(usage.peak_rss_kb, end_stats.peak_rss_kb);
+   }
+
+   for (int e = 0; e < 2; e++)
+   {
+      Engine *engine = (e == 0) ? &m_engine1 : &m_engine2;
+      perf_usage &perf = (e == 0) ? m_engine1_perf : m_engine2_perf;
+      perf_counts end_counts;
+
+      m_game_perf_valid[e] = m_game_start_perf_valid[e] && engine->read_perf_counters(end_counts);
+      if (!m_game_perf_valid[e])
+         continue;
+      perf.games++;
+      perf.nodes += m_nodes[e];
+      for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+      {
+         bool valid = (m_game_start_perf[e].value[i] >= 0) && (end_counts.value[i] >= 0);
+         m_game_perf[e].value[i] = valid ? (end_counts.value[i] - m_game_start_perf[e].value[i]) : -1;
+         if (valid)
+            perf.value[i] = max(perf.value[i], (int64_t)0) + m_game_perf[e].value[i];
+      }
+   }
 }
 
 bool GameManager::is_engine_unresponsive(void)
 {
-   if (m_thread_running)
+   // a game waiting for think tokens has no clock running.
+   if (m_game_running && (m_state != GAME_THINK_WAIT))
    {
       chrono::milliseconds elapsed_time_ms;
       elapsed_time_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_timestamp);
-      chrono::milliseconds clock_ms;
+      chrono::microseconds clock;
 
       if (options.fourplayerchess && !options.legacy_clocks)
       {
-         if (m_turn_4pc == RED) clock_ms = m_red_clock_ms;
-         else if (m_turn_4pc == BLUE) clock_ms = m_blue_clock_ms;
-         else if (m_turn_4pc == YELLOW) clock_ms = m_yellow_clock_ms;
-         else clock_ms = m_green_clock_ms;
+         if (m_turn_4pc == RED) clock = m_red_clock_us;
+         else if (m_turn_4pc == BLUE) clock = m_blue_clock_us;
+         else if (m_turn_4pc == YELLOW) clock = m_yellow_clock_us;
+         else clock = m_green_clock_us;
       }
       else
       {
-         clock_ms = (m_turn == WHITE) ? m_white_clock_ms : m_black_clock_ms;
+         clock = (m_turn == WHITE) ? m_white_clock_us : m_black_clock_us;
       }
 
       if ((elapsed_time_ms > 5s) && (!m_engine1.m_is_ready || !m_engine2.m_is_ready))
@@ -320,7 +706,7 @@ bool GameManager::is_engine_unresponsive(void)
          return true;
       }
 
-      if ((clock_ms - elapsed_time_ms) < -10s)
+      if ((clock - elapsed_time_ms) < -10s)
       {
          if (((m_turn == WHITE) && !m_swap_sides) || ((m_turn == BLACK) && m_swap_sides))
             log_event("Error: " + m_engine1.m_name + " (" + to_string(m_engine1.m_ID) + ") is not moving (clock < -10s).");
@@ -436,6 +822,33 @@ void GameManager::store_pgn(game_result result, const string &white_name, const
 
    temp_pgn << "[Result \"" << result_str << "\"]\n";
 
+   // engine process usage during the game (--proc): CPU time (s), RSS at the end of the game (KB), and voluntary/involuntary context switches
+   for (int c = 0; c < 2; c++)
+   {
+      int e = ((c == 0) != m_swap_sides) ? 0 : 1;
+      string color = (c == 0) ? "White" : "Black";
+      if (!m_game_stats_valid[e])
+         continue;
+      temp_pgn << "[" << color << "CPUTime \"" << (m_game_stats[e].cpu_ms / 1000) << "." << setfill('0') << setw(3) << (m_game_stats[e].cpu_ms % 1000) << setfill(' ') << "\"]\n";
+      temp_pgn << "[" << color << "RSS \"" << m_game_stats[e].rss_kb << "\"]\n";
+      temp_pgn << "[" << color << "CtxSwitches \"" << m_game_stats[e].voluntary_switches << "/" << m_game_stats[e].involuntary_switches << "\"]\n";
+   }
+
+   // hardware performance counters during the game (--perf): instructions per cycle, and instructions per node reported by the engine
+   for (int c = 0; c < 2; c++)
+   {
+      int e = ((c == 0) != m_swap_sides) ? 0 : 1;
+      string color = (c == 0) ? "White" : "Black";
+      int64_t instructions = m_game_perf[e].value[PERF_INSTRUCTIONS];
+      int64_t cycles = m_game_perf[e].value[PERF_CYCLES];
+      if (!m_game_perf_valid[e] || (instructions <= 0))
+         continue;
+      if (cycles > 0)
+         temp_pgn << "[" << color << "IPC \"" << fixed << setprecision(2) << ((double)instructions / cycles) << "\"]\n";
+      if (m_nodes[e] > 0)
+         temp_pgn << "[" << color << "InstructionsPerNode \"" << (instructions / m_nodes[e]) << "\"]\n";
+   }
+
    if (!m_fen.empty())
    {
       temp_pgn << "[SetUp \"1\"]\n";
@@ -459,7 +872,7 @@ void GameManager::store_pgn(game_result result, const string &white_name, const
 
    if ((result == DRAW) && m_repetition_draw)
       result_str = "{Draw by repetition} 1/2-1/2";
-   else if ((result == DRAW) && m_engine1.m_offered_draw && m_engine2.m_offered_draw)
+   else if ((result == DRAW) && m_draw_agreed)
       result_str = "{Draw by agreement} 1/2-1/2";
    else if ((result == DRAW) && (m_num_moves >= options.max_moves))
       result_str = "{Draw due to max moves reached} 1/2-1/2";
@@ -473,7 +886,6 @@ void GameManager::store_pgn(game_result result, const string &white_name, const
    temp_pgn << " " << result_str << "\n\n";
 
    m_pgn = temp_pgn.str();
-   m_pgn_valid.store(true, memory_order_release);
 }
 
 void GameManager::store_pgn4(game_result result, const string &white_name, const string &black_name,
@@ -484,7 +896,7 @@ void GameManager::store_pgn4(game_result result, const string &white_name, const
 
    if ((result == WHITE_WIN) || (result == BLACK_WIN))
    {
-      if (m_engine1.m_resigned || m_engine2.m_resigned)
+      if (m_resignation)
          m_move_vector.push_back("R"); // resignation
       else if (m_loss_on_time)
          m_move_vector.push_back("T"); // loss on time
@@ -494,7 +906,7 @@ void GameManager::store_pgn4(game_result result, const string &white_name, const
    else if (result == DRAW)
    {
       if ((m_repetition_draw) ||
-          (m_engine1.m_offered_draw && m_engine2.m_offered_draw) ||
+          m_draw_agreed ||
           (m_num_moves >= options.max_moves) ||
           (options.early_draw && (m_drawish_count >= options.draw_moves)))
          m_move_vector.push_back("D"); // Draw by repetition, or draw by agreement, or draw adjudicated
@@ -519,7 +931,7 @@ void GameManager::store_pgn4(game_result result, const string &white_name, const
       temp_pgn << "[Result \"1/2-1/2\"]\n";
       if (m_repetition_draw)
          temp_pgn << "[Termination \"Draw by repetition\"]\n";
-      else if (m_engine1.m_offered_draw && m_engine2.m_offered_draw)
+      else if (m_draw_agreed)
          temp_pgn << "[Termination \"Draw by agreement\"]\n";
       else if (m_num_moves >= options.max_moves)
          temp_pgn << "[Termination \"Draw due to max moves reached\"]\n";
@@ -546,16 +958,46 @@ void GameManager::store_pgn4(game_result result, const string &white_name, const
    temp_pgn << "\n\n";
 
    m_pgn = temp_pgn.str();
-   m_pgn_valid.store(true, memory_order_release);
 }
 
 void GameManager::move_played(const string &move)
 {
-   m_move_list.append(move + " ");
+   m_move_list.append(move);
+   m_move_list.push_back(' ');
+   m_position_cmd.append(move);
+   m_position_cmd.push_back(' ');
    m_move_vector.push_back(move);
    m_num_moves++;
 }
 
+// Play moves into an idle slot's game record without engines, with the adjudication checks made after every move, and
+// store the PGN with the given result unless it's UNFINISHED. Returns the adjudication of the last move.
+// Used by bench/bench_helpers.cpp to measure the per-ply and per-game costs of the harness.
+game_result GameManager::replay_moves(const string &fen, const vector<string> &moves, game_result result)
+{
+   game_result adjudication = UNFINISHED;
+
+   m_fen = fen;
+   m_swap_sides = false;
+   m_move_list.clear();
+   m_position_cmd.clear();
+   m_move_vector.clear();
+   m_num_moves = 0;
+   m_drawish_count = 0;
+   m_loss_on_time = false;
+   m_repetition_draw = false;
+   m_draw_agreed = false;
+   m_resignation = false;
+   for (size_t i = 0; i < moves.size(); i++)
+   {
+      move_played(moves[i]);
+      adjudication = check_for_adjudication(&m_engine1, &m_engine2);
+   }
+   if (result != UNFINISHED)
+      store_pgn(result, "Engine1", "Engine2", 60000ms, 1000ms, 0ms);
+   return adjudication;
+}
+
 game_result GameManager::check_for_adjudication(Engine *white_engine, Engine *black_engine)
 {
    if (white_engine->m_offered_draw && black_engine->m_offered_draw)
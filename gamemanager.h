@@ -2,8 +2,81 @@
 #define GAMEMANAGER_H
 
 #include "engine.h"
+#include "histogram.h"
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <deque>
+
+enum game_state
+{
+   GAME_IDLE,                 // no game in progress
+   GAME_ENGINE_STARTUP,       // waiting for both engines to complete the startup handshake
+   GAME_SETUP,                // waiting for both engines to finish new game setup ("readyok" / "pong")
+   GAME_SETUP_DELAY,          // --setup-delay before the first move
+   GAME_THINK_WAIT,           // waiting for CPU think tokens before the engine to move is sent "go"
+   GAME_PLAYING,              // waiting for the engine to move
+   GAME_FINISHING             // checking remaining engine output for the game result
+};
+
+// Clock overhead of an engine's moves: the move time measured by the harness, from writing "go" to the pipe until reading
+// the move from the pipe, minus the engine's own last reported search time. Only moves with a reported time are counted.
+// This includes the engine's work after its last "info time", so it is an upper bound for the harness and pipe overhead.
+struct clock_overhead
+{
+   uint64_t moves;
+   int64_t total_us;
+   int64_t max_us;
+};
+
+// Resource usage of an engine over all its games in a game slot, from process_stats sampled at the start and end of each game.
+struct engine_usage
+{
+   uint64_t games;
+   int64_t cpu_ms;                  // CPU time used during the games
+   int64_t think_ms;                // time on the engine's clock during the games, so cpu_ms / think_ms is the number of threads it used
+   int64_t voluntary_switches;
+   int64_t involuntary_switches;
+   int64_t first_rss_kb;            // RSS after the first game
+   int64_t rss_kb;                  // RSS after the last game, so that memory leaks show up as growth from first_rss_kb
+   int64_t peak_rss_kb;
+};
+
+// Hardware performance counters of an engine over all its games in a game slot (--perf), with the nodes it reported,
+// for IPC and instructions per node. A counter that was never available is -1.
+struct perf_usage
+{
+   uint64_t games;
+   int64_t nodes;
+   int64_t value[PERF_NUM_COUNTERS];
+};
+
+// Time the harness spends on each move of a game slot (microseconds).
+struct harness_latency
+{
+   LatencyHistogram turnaround;     // from reading an engine's move until the opponent's "go" is written (not counting think token waits)
+   LatencyHistogram adjudication;   // check_for_adjudication
+   LatencyHistogram move_played;    // move_played: move list, position command and repetition check
+   LatencyHistogram logging;        // --pmoves log of the move
+   LatencyHistogram turnover;       // from the end of the previous game in the slot until the first "go" of the next game is written
+};
+
+// A game assigned to a game slot by MatchManager.
+struct game_assignment
+{
+   string fen;
+   bool swap_sides;
+   uint pair_id;
+};
+
+// A completed game, passed back from the reactor thread to MatchManager.
+struct finished_game
+{
+   game_result result;
+   bool swap_sides;
+   uint pair_id;
+   string pgn;                      // empty if no moves were played
+};
 
 void convert_move_to_PGN4_format(string &move);
 void convert_move_to_standard_engine_format(string &move);
@@ -19,19 +92,43 @@ public:
    uint m_engine1_losses_on_time;
    uint m_engine2_losses_on_time;
    uint m_illegal_move_games;
-   atomic<bool> m_thread_running;
+   uint64_t m_plies;                // plies played in all games of the slot
+   clock_overhead m_engine1_overhead;
+   clock_overhead m_engine2_overhead;
+   harness_latency m_latency;
+   engine_usage m_engine1_usage;
+   engine_usage m_engine2_usage;
+   perf_usage m_engine1_perf;
+   perf_usage m_engine2_perf;
+   atomic<bool> m_game_running;     // only changed on the reactor thread
    bool m_swap_sides;
    atomic<bool> m_error;
    atomic<bool> m_engine_disconnected;
+   atomic<bool> m_engines_started;  // both engines completed the startup handshake
    string m_fen;
    string m_pgn;
-   atomic<bool> m_pgn_valid;
-
-   game_result m_final_result;
    uint m_pair_id;
 
+   // timer used by the I/O reactor thread
+   bool m_timer_armed;
+   chrono::time_point<std::chrono::steady_clock> m_timer_deadline;
+
+   uint m_think_tokens;       // CPU think tokens held by the engine that is thinking (see IOReactor::acquire_think_tokens)
+
 private:
+   game_state m_state;
+   Engine *m_white_engine;
+   Engine *m_black_engine;
+   uint m_finish_step;
+   uint m_setup_pending;      // engines that haven't finished new game setup yet
+   mutex m_finished_mutex;
+   deque<finished_game> m_finished_games;   // protected by m_finished_mutex: completed games not yet collected by MatchManager
+   bool m_draw_agreed;                      // both engines offered a draw (saved at the end of the game for the PGN)
+   bool m_resignation;                      // an engine resigned (saved at the end of the game for the PGN)
+   chrono::time_point<std::chrono::steady_clock> m_game_end_time;   // when the previous game in the slot was completed
+   bool m_game_end_time_valid;
    string m_move_list;
+   string m_position_cmd;     // UCI "position ... moves" command for the current game, extended by each move played
    vector<string> m_move_vector;
    player_color m_turn;
    player_color_4pc m_turn_4pc;
@@ -40,28 +137,66 @@ private:
    bool m_loss_on_time;
    bool m_repetition_draw;
    chrono::time_point<std::chrono::steady_clock> m_timestamp; // This timestamp is updated whenever either engine's clock should start running.
-                                                              // It's also updated when game_runner starts running.
-   chrono::milliseconds m_white_clock_ms;
-   chrono::milliseconds m_black_clock_ms;
-   chrono::milliseconds m_red_clock_ms;
-   chrono::milliseconds m_blue_clock_ms;
-   chrono::milliseconds m_yellow_clock_ms;
-   chrono::milliseconds m_green_clock_ms;
+                                                              // It's also updated when a new game is started.
+   chrono::microseconds m_white_clock_us;
+   chrono::microseconds m_black_clock_us;
+   chrono::microseconds m_red_clock_us;
+   chrono::microseconds m_blue_clock_us;
+   chrono::microseconds m_yellow_clock_us;
+   chrono::microseconds m_green_clock_us;
+   chrono::time_point<std::chrono::steady_clock> m_last_move_time;   // when the previous move was read from the engine's pipe
+   bool m_turn_waited;                                                // the engine to move had to wait for think tokens
+   process_stats m_game_start_stats[2];   // engine1 / engine2 process stats at the start of the game
+   bool m_game_start_stats_valid[2];
+   process_stats m_game_stats[2];         // engine1 / engine2 usage during the game (CPU time and context switches are differences)
+   bool m_game_stats_valid[2];
+   int64_t m_think_us[2];                 // engine1 / engine2 time on the clock during the game
+   int64_t m_nodes[2];                    // engine1 / engine2 nodes searched during the game, as reported by the engines
+   perf_counts m_game_start_perf[2];      // engine1 / engine2 performance counters at the start of the game
+   bool m_game_start_perf_valid[2];
+   perf_counts m_game_perf[2];            // engine1 / engine2 performance counters during the game
+   bool m_game_perf_valid[2];
+   DebugRing m_debug_ring;                // engine I/O of the current game (--debug-failed)
+   chrono::milliseconds m_start_time_ms;
+   chrono::milliseconds m_increment_ms;
+   chrono::milliseconds m_fixed_time_ms;
+   chrono::microseconds *m_go_engine_clock;     // clocks sent with the last move: the engine to move's clock,
+   chrono::microseconds *m_go_opp_clock;        // and the clock of the player who made the move
 
 public:
    GameManager(void);
    ~GameManager(void);
-   void game_runner(void);
+   void start_engines(void);
+   bool collect_finished_game(finished_game &game);
+   bool can_start_game(void);
+   void start_game(const game_assignment &game);
+   void service_engines(void);
+   void timer_expired(void);
+   void think_tokens_granted(void);
    bool is_engine_unresponsive(void);
+   game_result replay_moves(const string &fen, const vector<string> &moves, game_result result);
 
 private:
-   game_result run_engine_game(chrono::milliseconds start_time_ms, chrono::milliseconds increment_ms, chrono::milliseconds fixed_time_ms);
+   void arm_timer(chrono::milliseconds delay);
+   void send_new_game_setup(const game_assignment &game);
+   void begin_game(const game_assignment &game);
+   void handle_engine_event(Engine *engine, engine_event event);
+   void select_clocks(chrono::microseconds **current_clock_ptr, chrono::microseconds **next_clock_ptr, string &color_name);
+   void next_turn(void);
+   void start_turn(void);
+   void send_go(void);
+   void engine_moved(Engine *engine);
+   void conclude_game(game_result result);
+   void check_remaining_output(void);
+   void game_completed(game_result result);
    game_result determine_game_result(Engine *white_engine, Engine *black_engine);
    void store_pgn(game_result result, const string &white_name, const string &black_name,
                   chrono::milliseconds start_time_ms, chrono::milliseconds increment_ms, chrono::milliseconds fixed_time_ms);
    void store_pgn4(game_result result, const string &white_name, const string &black_name,
                    chrono::milliseconds start_time_ms, chrono::milliseconds increment_ms, chrono::milliseconds fixed_time_ms);
    void move_played(const string &move);
+   void update_engine_usage(void);
+   void dump_debug_ring(game_result result);
    bool check_for_repetition_draw(void);
    game_result check_for_adjudication(Engine *white_engine, Engine *black_engine);
 };
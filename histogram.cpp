@@ -0,0 +1,91 @@
+#include "histogram.h"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram(void)
+{
+   clear();
+}
+
+void LatencyHistogram::clear(void)
+{
+   fill(m_counts, m_counts + num_buckets, 0);
+   m_count = 0;
+   m_max = 0;
+}
+
+int LatencyHistogram::bucket_index(int64_t value)
+{
+   const int sub_buckets = 1 << sub_bucket_bits;
+
+   if (value < sub_buckets)
+      return (value < 0) ? 0 : (int)value;
+
+   int exponent = 63 - __builtin_clzll((uint64_t)value);
+   int index = ((exponent - sub_bucket_bits + 1) << sub_bucket_bits) + (int)((value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1));
+   return min(index, num_buckets - 1);
+}
+
+int64_t LatencyHistogram::bucket_lower(int index)
+{
+   const int sub_buckets = 1 << sub_bucket_bits;
+
+   if (index < sub_buckets)
+      return index;
+
+   int shift = (index >> sub_bucket_bits) - 1;
+   return (int64_t)(sub_buckets + (index & (sub_buckets - 1))) << shift;
+}
+
+int64_t LatencyHistogram::bucket_upper(int index)
+{
+   return (index < (1 << sub_bucket_bits)) ? index : (bucket_lower(index + 1) - 1);
+}
+
+void LatencyHistogram::record(int64_t value_us)
+{
+   m_counts[bucket_index(value_us)]++;
+   m_count++;
+   m_max = std::max(m_max, value_us);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+   for (int i = 0; i < num_buckets; i++)
+      m_counts[i] += other.m_counts[i];
+   m_count += other.m_count;
+   m_max = std::max(m_max, other.m_max);
+}
+
+uint64_t LatencyHistogram::count(void) const
+{
+   return m_count;
+}
+
+int64_t LatencyHistogram::max(void) const
+{
+   return m_max;
+}
+
+// Upper bound of the bucket holding the p-th percentile (0 < p <= 100), or 0 if nothing was recorded.
+int64_t LatencyHistogram::percentile(double p) const
+{
+   uint64_t rank = (uint64_t)((p / 100.0) * m_count + 0.5);
+   uint64_t seen = 0;
+
+   rank = std::max(rank, (uint64_t)1);
+   for (int i = 0; i < num_buckets; i++)
+   {
+      seen += m_counts[i];
+      if (seen >= rank)
+         return std::min(bucket_upper(i), m_max);
+   }
+   return m_max;
+}
+
+// One line per non-empty bucket: "lower-upper count".
+void LatencyHistogram::dump(ostream &out) const
+{
+   for (int i = 0; i < num_buckets; i++)
+      if (m_counts[i] != 0)
+         out << "   " << bucket_lower(i) << "-" << bucket_upper(i) << " us: " << m_counts[i] << "\n";
+}
@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+// Latency histogram (microseconds) with log-linear buckets: values below 8 are exact, and every power of two above
+// that is split into 8 buckets, so a recorded value is off by at most 12.5%. Recording is a few instructions.
+class LatencyHistogram
+{
+public:
+   LatencyHistogram(void);
+   void record(int64_t value_us);
+   void merge(const LatencyHistogram &other);
+   void clear(void);
+   uint64_t count(void) const;
+   int64_t max(void) const;
+   int64_t percentile(double p) const;
+   void dump(ostream &out) const;
+
+private:
+   static const int sub_bucket_bits = 3;
+   static const int num_buckets = 40 << sub_bucket_bits;    // up to 2^42 us
+
+   static int bucket_index(int64_t value);
+   static int64_t bucket_lower(int index);
+   static int64_t bucket_upper(int index);
+
+   uint64_t m_counts[num_buckets];
+   uint64_t m_count;
+   int64_t m_max;
+};
+
+#endif // HISTOGRAM_H
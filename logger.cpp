@@ -1,44 +1,283 @@
 #include "logger.h"
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 ofstream g_event_log;
 ofstream g_debug1_log;
 ofstream g_debug2_log;
 ofstream g_moves_log;
+ofstream g_debug_failed_log;
 
-std::mutex g_log_mutex;
+const chrono::milliseconds log_flush_interval = 200ms;
+const size_t log_flush_bytes = 64 * 1024;
 
-void log_event(const string &msg)
+struct log_entry
 {
-   std::lock_guard<std::mutex> lock(g_log_mutex);
-   if (g_event_log.is_open())
+   uint64_t seq;   // lines of all threads are written in the order they were logged
+   ofstream *file;
+   string msg;
+   atomic<log_entry *> next;
+};
+
+struct log_line
+{
+   uint64_t seq;
+   ofstream *file;
+   string msg;
+};
+
+// Single producer (the thread that owns it), single consumer (the writer thread) queue. A linked list with a dummy
+// head node, so that the producer only touches m_tail and the consumer only touches m_head.
+class LogQueue
+{
+public:
+   LogQueue(void)
    {
-      g_event_log << msg << "\n";
-      g_event_log.flush();
+      m_head = m_tail = new log_entry;
+      m_head->file = nullptr;
+      m_head->next.store(nullptr, memory_order_relaxed);
    }
-}
 
-void log_debug(engine_number num, const string &msg)
+   ~LogQueue(void)
+   {
+      while (m_head != nullptr)
+      {
+         log_entry *next = m_head->next.load(memory_order_relaxed);
+         delete m_head;
+         m_head = next;
+      }
+   }
+
+   void push(uint64_t seq, ofstream *file, const string &msg)
+   {
+      log_entry *entry = new log_entry;
+      entry->seq = seq;
+      entry->file = file;
+      entry->msg = msg;
+      entry->next.store(nullptr, memory_order_relaxed);
+      m_tail->next.store(entry, memory_order_release);
+      m_tail = entry;
+   }
+
+   // Moves all queued entries to lines. Returns the number of bytes taken.
+   size_t drain(vector<log_line> &lines)
+   {
+      size_t bytes = 0;
+      log_entry *next;
+      while ((next = m_head->next.load(memory_order_acquire)) != nullptr)
+      {
+         bytes += next->msg.size() + 1;
+         lines.push_back({ next->seq, next->file, move(next->msg) });
+         delete m_head;
+         m_head = next;   // the entry taken becomes the new dummy head
+      }
+      return bytes;
+   }
+
+private:
+   log_entry *m_head;
+   log_entry *m_tail;
+};
+
+class LogWriter
 {
-   std::lock_guard<std::mutex> lock(g_log_mutex);
-   if (num == FIRST && g_debug1_log.is_open())
+public:
+   LogWriter(void)
    {
-      g_debug1_log << msg << "\n";
-      g_debug1_log.flush();
+      m_stop = false;
+      m_urgent = false;
+      m_pending_bytes = 0;
+      m_seq = 0;
+      m_next_seq = 0;
+      m_flush_requested = 0;
+      m_flush_done = 0;
    }
-   else if (num == SECOND && g_debug2_log.is_open())
+
+   ~LogWriter(void)
+   {
+      stop();
+      for (uint i = 0; i < m_queues.size(); i++)
+         delete m_queues[i];
+   }
+
+   void start(void)
+   {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_thread.joinable())
+         return;
+      m_stop = false;
+      m_thread = thread(&LogWriter::run, this);
+   }
+
+   void stop(void)
+   {
+      {
+         lock_guard<mutex> lock(m_mutex);
+         m_stop = true;
+      }
+      m_cond.notify_all();
+      if (m_thread.joinable())
+         m_thread.join();
+      write_all(true);   // lines logged without a writer thread, or after it stopped
+   }
+
+   void push(ofstream *file, const string &msg, bool urgent)
+   {
+      thread_local LogQueue *queue = nullptr;
+      if (queue == nullptr)
+      {
+         queue = new LogQueue;
+         lock_guard<mutex> lock(m_queues_mutex);
+         m_queues.push_back(queue);
+      }
+      queue->push(m_seq.fetch_add(1, memory_order_relaxed), file, msg);
+
+      size_t pending = m_pending_bytes.fetch_add(msg.size() + 1, memory_order_relaxed) + msg.size() + 1;
+      if (urgent)
+      {
+         // under the mutex, so that the writer can't miss the wake-up between checking m_urgent and waiting.
+         lock_guard<mutex> lock(m_mutex);
+         m_urgent.store(true, memory_order_relaxed);
+         m_cond.notify_one();
+      }
+      else if ((pending >= log_flush_bytes) && (pending - msg.size() - 1 < log_flush_bytes))
+         m_cond.notify_one();
+   }
+
+   // Returns once everything logged before the call is written and flushed.
+   void flush(void)
+   {
+      unique_lock<mutex> lock(m_mutex);
+      if (!m_thread.joinable())
+      {
+         lock.unlock();
+         write_all(false);
+         return;
+      }
+      uint64_t request = ++m_flush_requested;
+      m_cond.notify_all();
+      m_flush_cond.wait(lock, [&] { return m_flush_done >= request; });
+   }
+
+private:
+   vector<LogQueue *> m_queues;   // protected by m_queues_mutex, a queue is added by each thread the first time it logs
+   mutex m_queues_mutex;
+   mutex m_write_mutex;           // held while the queues are drained and the files written
+
+   thread m_thread;
+   mutex m_mutex;
+   condition_variable m_cond;
+   condition_variable m_flush_cond;
+   bool m_stop;                   // protected by m_mutex
+   uint64_t m_flush_requested;    // protected by m_mutex
+   uint64_t m_flush_done;         // protected by m_mutex
+   atomic<bool> m_urgent;
+   atomic<size_t> m_pending_bytes;
+   atomic<uint64_t> m_seq;
+   uint64_t m_next_seq;           // protected by m_write_mutex: the next line to write
+   vector<log_line> m_lines;      // protected by m_write_mutex: lines drained but not written yet
+
+   void run(void)
    {
-      g_debug2_log << msg << "\n";
-      g_debug2_log.flush();
+      unique_lock<mutex> lock(m_mutex);
+      while (true)
+      {
+         m_cond.wait_for(lock, log_flush_interval, [&] { return m_stop || (m_flush_requested != m_flush_done) || m_urgent.load(memory_order_relaxed)
+                                                                 || (m_pending_bytes.load(memory_order_relaxed) >= log_flush_bytes); });
+         bool stop = m_stop;
+         uint64_t request = m_flush_requested;
+         lock.unlock();
+
+         write_all(false);
+
+         lock.lock();
+         m_flush_done = request;
+         m_flush_cond.notify_all();
+         if (stop)
+            return;
+      }
+   }
+
+   // A thread takes its line's seq before queueing the line, so a drained batch can be missing a line with a lower seq
+   // that another thread is still queueing. Lines after such a gap are kept for the next batch, unless force is set
+   // (log_stop, once the threads are done logging).
+   void write_all(bool force)
+   {
+      lock_guard<mutex> write_lock(m_write_mutex);
+      m_urgent.store(false, memory_order_relaxed);
+      size_t bytes = 0;
+      {
+         lock_guard<mutex> lock(m_queues_mutex);
+         for (uint i = 0; i < m_queues.size(); i++)
+            bytes += m_queues[i]->drain(m_lines);
+      }
+      m_pending_bytes.fetch_sub(bytes, memory_order_relaxed);
+
+      sort(m_lines.begin(), m_lines.end(), [](const log_line &a, const log_line &b) { return a.seq < b.seq; });
+      uint written = 0;
+      for (; written < m_lines.size(); written++)
+      {
+         if (!force && (m_lines[written].seq != m_next_seq))
+            break;
+         if (m_lines[written].file->is_open())
+            *m_lines[written].file << m_lines[written].msg << "\n";
+         m_next_seq = m_lines[written].seq + 1;
+      }
+      m_lines.erase(m_lines.begin(), m_lines.begin() + written);
+
+      if (g_event_log.is_open()) g_event_log.flush();
+      if (g_debug1_log.is_open()) g_debug1_log.flush();
+      if (g_debug2_log.is_open()) g_debug2_log.flush();
+      if (g_moves_log.is_open()) g_moves_log.flush();
+      if (g_debug_failed_log.is_open()) g_debug_failed_log.flush();
    }
+};
+
+// Declared after the files, so that it's destroyed (and the remaining lines written) before they are closed.
+LogWriter g_log_writer;
+
+void log_start(void)
+{
+   g_log_writer.start();
+}
+
+void log_flush(void)
+{
+   g_log_writer.flush();
+}
+
+void log_stop(void)
+{
+   g_log_writer.stop();
+}
+
+void log_event(const string &msg)
+{
+   if (g_event_log.is_open())
+      g_log_writer.push(&g_event_log, msg, true);
+}
+
+void log_debug(engine_number num, const string &msg)
+{
+   if (num == FIRST && g_debug1_log.is_open())
+      g_log_writer.push(&g_debug1_log, msg, false);
+   else if (num == SECOND && g_debug2_log.is_open())
+      g_log_writer.push(&g_debug2_log, msg, false);
 }
 
 void log_move(const string &msg)
 {
-   std::lock_guard<std::mutex> lock(g_log_mutex);
    if (g_moves_log.is_open())
-   {
-      g_moves_log << msg << "\n";
-      g_moves_log.flush();
-   }
-}
\ No newline at end of file
+      g_log_writer.push(&g_moves_log, msg, false);
+}
+
+// The engine I/O of a failed game (--debug-failed), written as one block, and flushed right away like an event.
+void log_failed_game(const string &msg)
+{
+   if (g_debug_failed_log.is_open())
+      g_log_writer.push(&g_debug_failed_log, msg, true);
+}
@@ -11,9 +11,19 @@ extern ofstream g_event_log;
 extern ofstream g_debug1_log;
 extern ofstream g_debug2_log;
 extern ofstream g_moves_log;
+extern ofstream g_debug_failed_log;
+
+// Log lines are queued by the calling thread without locking, and written to the files in batches by a background
+// writer thread started by log_start, so that debug logging doesn't hold up the games. The files are flushed every
+// log_flush_interval, once log_flush_bytes are queued, right after an event is logged (events are mostly errors),
+// and by log_flush and log_stop. log_stop writes the remaining lines, and must be called before the files are closed.
+void log_start(void);
+void log_flush(void);
+void log_stop(void);
 
 void log_event(const string &msg);
 void log_debug(engine_number num, const string &msg);
 void log_move(const string &msg);
+void log_failed_game(const string &msg);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,75 @@
+#include "notifier.h"
+#include <algorithm>
+#include <cstdint>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+MainLoopNotifier g_main_notifier;
+
+#ifdef __linux__
+MainLoopNotifier::MainLoopNotifier(void)
+{
+   m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   // stdin that isn't a terminal (e.g. /dev/null when scm is run by a script) would always be readable at EOF.
+   m_watch_stdin = (isatty(0) != 0);
+}
+
+MainLoopNotifier::~MainLoopNotifier(void)
+{
+   if (m_event_fd != -1)
+      close(m_event_fd);
+}
+
+void MainLoopNotifier::notify(void)
+{
+   uint64_t count = 1;
+   if (write(m_event_fd, &count, sizeof(count)) < 0)
+      return;   // the counter can't overflow in practice, and the main loop still wakes up on its timer
+}
+
+// Wait until notify is called, a key is pressed, or the timeout expires. A notification sent since the last wait returns at once.
+void MainLoopNotifier::wait(chrono::milliseconds timeout)
+{
+   pollfd fds[2];
+   fds[0].fd = m_event_fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = 0;
+   fds[1].events = POLLIN;
+
+   if ((poll(fds, m_watch_stdin ? 2 : 1, (int)max(timeout.count(), (chrono::milliseconds::rep)0)) > 0) && (fds[0].revents & POLLIN))
+   {
+      uint64_t count;
+      if (read(m_event_fd, &count, sizeof(count)) < 0)
+         return;
+   }
+}
+#else
+MainLoopNotifier::MainLoopNotifier(void)
+{
+   m_notified = false;
+}
+
+MainLoopNotifier::~MainLoopNotifier(void)
+{
+}
+
+void MainLoopNotifier::notify(void)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_notified = true;
+   }
+   m_cond.notify_one();
+}
+
+// Wait until notify is called or the timeout expires. A notification sent since the last wait returns at once.
+void MainLoopNotifier::wait(chrono::milliseconds timeout)
+{
+   unique_lock<mutex> lock(m_mutex);
+   m_cond.wait_for(lock, timeout, [this] { return m_notified; });
+   m_notified = false;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+
+// Wakes up the MatchManager main loop as soon as a game has ended or an engine has failed, instead of it polling the games.
+// On Linux, the main loop waits on an eventfd, together with stdin if it is a terminal, so that a key press wakes it up too.
+// On other platforms, it waits on a condition variable, and the keyboard is checked when the wait times out.
+// notify may be called from any thread, wait only from the main thread.
+class MainLoopNotifier
+{
+public:
+   MainLoopNotifier(void);
+   ~MainLoopNotifier(void);
+   void notify(void);
+   void wait(chrono::milliseconds timeout);
+
+private:
+#ifdef __linux__
+   int m_event_fd;
+   bool m_watch_stdin;
+#else
+   mutex m_mutex;
+   condition_variable m_cond;
+   bool m_notified;
+#endif
+};
+
+extern MainLoopNotifier g_main_notifier;
+
+#endif // NOTIFIER_H
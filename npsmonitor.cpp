@@ -0,0 +1,83 @@
+#include "npsmonitor.h"
+#include <algorithm>
+
+NpsMonitor g_nps_monitor;
+
+NpsMonitor::NpsMonitor(void)
+{
+   for (int e = 0; e < 2; e++)
+   {
+      m_next[e] = 0;
+      m_new_samples[e] = 0;
+      m_baseline[e] = 0;
+   }
+   m_baseline_closed = false;
+}
+
+static int64_t median(vector<int64_t> values)
+{
+   if (values.empty())
+      return 0;
+   nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+   return values[values.size() / 2];
+}
+
+// Record the NPS of a move by engine 0 (engine1) or 1 (engine2).
+void NpsMonitor::record(int engine, int64_t nps, int64_t time_ms)
+{
+   if ((nps <= 0) || (time_ms < min_move_time_ms))
+      return;
+
+   lock_guard<mutex> lock(m_mutex);
+   if (m_baseline[engine] == 0)
+   {
+      if (m_baseline_closed)
+         return;
+      m_samples[engine].push_back(nps);
+      if (m_samples[engine].size() == window_size)
+         m_baseline[engine] = median(m_samples[engine]);
+      return;
+   }
+   m_samples[engine][m_next[engine]] = nps;
+   m_next[engine] = (m_next[engine] + 1) % window_size;
+   m_new_samples[engine]++;
+}
+
+bool NpsMonitor::has_baseline(void)
+{
+   lock_guard<mutex> lock(m_mutex);
+   return ((m_baseline[0] != 0) && (m_baseline[1] != 0));
+}
+
+int64_t NpsMonitor::baseline(int engine)
+{
+   lock_guard<mutex> lock(m_mutex);
+   return m_baseline[engine];
+}
+
+// Moves recorded so far for the baseline of an engine.
+int NpsMonitor::baseline_samples(int engine)
+{
+   lock_guard<mutex> lock(m_mutex);
+   return (m_baseline[engine] != 0) ? window_size : (int)m_samples[engine].size();
+}
+
+// Stop collecting baseline samples. An engine without a baseline yet isn't monitored, since its later moves
+// would be measured under full load.
+void NpsMonitor::close_baseline(void)
+{
+   lock_guard<mutex> lock(m_mutex);
+   m_baseline_closed = true;
+}
+
+// Returns true, with the median NPS of the last window_size moves, once that many moves were recorded since the last call,
+// so that each decision is based on moves that weren't used for the previous one.
+bool NpsMonitor::take_window(int engine, int64_t &recent_nps)
+{
+   lock_guard<mutex> lock(m_mutex);
+   if ((m_baseline[engine] == 0) || (m_new_samples[engine] < window_size))
+      return false;
+   recent_nps = median(m_samples[engine]);
+   m_new_samples[engine] = 0;
+   return true;
+}
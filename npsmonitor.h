@@ -0,0 +1,38 @@
+#ifndef NPSMONITOR_H
+#define NPSMONITOR_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+// Tracks the NPS each engine reports for its moves, against a baseline taken from its first moves of the match
+// (while only one game runs, see MatchManager::check_nps). A drop shows that the machine is busy or thermally throttled.
+// Moves are recorded on the I/O reactor thread, and checked on the main thread.
+class NpsMonitor
+{
+public:
+   NpsMonitor(void);
+   void record(int engine, int64_t nps, int64_t time_ms);
+   bool has_baseline(void);
+   int64_t baseline(int engine);
+   int baseline_samples(int engine);
+   void close_baseline(void);
+   bool take_window(int engine, int64_t &recent_nps);
+
+   static const int window_size = 50;           // moves in the baseline, and in each window compared against it
+   static const int64_t min_move_time_ms = 100; // shorter searches report unstable NPS
+
+private:
+   mutex m_mutex;
+   vector<int64_t> m_samples[2];    // baseline samples, then a ring buffer of the most recent moves
+   size_t m_next[2];                // next ring buffer position
+   int m_new_samples[2];            // moves recorded since the last window was taken
+   int64_t m_baseline[2];           // median NPS of the first window_size moves, or 0 while they are collected
+   bool m_baseline_closed;          // no more baseline samples are collected (the baseline wasn't completed at low load)
+};
+
+extern NpsMonitor g_nps_monitor;
+
+#endif // NPSMONITOR_H
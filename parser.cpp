@@ -0,0 +1,200 @@
+#include "parser.h"
+
+static inline bool is_space(char c)
+{
+   return ((c == ' ') || (c == '\t'));
+}
+
+static inline bool is_digit(char c)
+{
+   return ((c >= '0') && (c <= '9'));
+}
+
+static inline char to_lower(char c)
+{
+   return ((c >= 'A') && (c <= 'Z')) ? (c + ('a' - 'A')) : c;
+}
+
+void reset_search_info(search_info &info)
+{
+   info.has_score = false;
+   info.mate_score = false;
+   info.score = 0;
+   info.depth = -1;
+   info.nodes = -1;
+   info.nps = -1;
+   info.time_ms = -1;
+}
+
+// Returns the next token (separated by spaces/tabs) starting at pos, and moves pos past the token.
+static string_view next_token(string_view s, size_t &pos)
+{
+   size_t len = s.length();
+   while ((pos < len) && is_space(s[pos]))
+      pos++;
+   size_t start = pos;
+   while ((pos < len) && !is_space(s[pos]))
+      pos++;
+   return s.substr(start, pos - start);
+}
+
+// Parses an integer starting at pos, skipping leading whitespace (like "stream >> value").
+// On success, pos is moved past the last digit.
+static bool parse_number(string_view s, size_t &pos, int64_t &value)
+{
+   size_t len = s.length();
+   bool negative = false;
+   int64_t n = 0;
+
+   while ((pos < len) && is_space(s[pos]))
+      pos++;
+   if ((pos < len) && ((s[pos] == '-') || (s[pos] == '+')))
+   {
+      negative = (s[pos] == '-');
+      pos++;
+   }
+   if ((pos >= len) || !is_digit(s[pos]))
+      return false;
+   while ((pos < len) && is_digit(s[pos]))
+   {
+      if (n < 100000000000000000LL) // ignore digits that would overflow
+         n = (n * 10) + (s[pos] - '0');
+      pos++;
+   }
+   value = negative ? -n : n;
+   return true;
+}
+
+static bool parse_token_number(string_view token, int64_t &value)
+{
+   size_t pos = 0;
+   return parse_number(token, pos, value);
+}
+
+// Case-insensitive check for a (lowercase) keyword at position pos.
+static bool matches_at(string_view s, size_t pos, string_view keyword)
+{
+   if ((pos > s.length()) || (s.length() - pos < keyword.length()))
+      return false;
+   for (size_t i = 0; i < keyword.length(); i++)
+      if (to_lower(s[pos + i]) != keyword[i])
+         return false;
+   return true;
+}
+
+// Parse a UCI info line, e.g. "info depth 20 seldepth 28 score cp 31 nodes 1234567 nps 1500000 time 823 pv e2e4 e7e5".
+// Returns false if the line isn't an info line.
+bool parse_uci_info(string_view line, search_info &info)
+{
+   size_t pos = 0;
+   int64_t value;
+
+   reset_search_info(info);
+   if (next_token(line, pos) != "info")
+      return false;
+
+   while (1)
+   {
+      string_view token = next_token(line, pos);
+
+      // the rest of the line after "pv" is a list of moves, and the rest of the line after "string" is free text.
+      if (token.empty() || (token == "pv") || (token == "string"))
+         break;
+
+      if (token == "score")
+      {
+         string_view type = next_token(line, pos);
+         if ((type == "cp") || (type == "mate"))
+         {
+            if (parse_token_number(next_token(line, pos), value))
+            {
+               info.has_score = true;
+               info.mate_score = (type == "mate");
+               info.score = (int)value;
+            }
+         }
+      }
+      else if (token == "depth")
+      {
+         if (parse_token_number(next_token(line, pos), value))
+            info.depth = (int)value;
+      }
+      else if (token == "nodes")
+         parse_token_number(next_token(line, pos), info.nodes);
+      else if (token == "nps")
+         parse_token_number(next_token(line, pos), info.nps);
+      else if (token == "time")
+         parse_token_number(next_token(line, pos), info.time_ms);
+   }
+   return true;
+}
+
+// Parse an xboard thinking output line: "ply score time nodes pv", e.g. "20 31 82 1234567 e2e4 e7e5".
+// Note: xboard time is in centiseconds. Returns false if the line isn't a thinking output line.
+bool parse_xboard_thinking(string_view line, search_info &info)
+{
+   size_t pos = 0;
+   int64_t ply, score, time, nodes;
+
+   reset_search_info(info);
+   if (!parse_number(line, pos, ply) || !parse_number(line, pos, score) || !parse_number(line, pos, time) || !parse_number(line, pos, nodes))
+      return false;
+
+   info.has_score = true;
+   info.score = (int)score;
+   info.depth = (int)ply;
+   info.time_ms = time * 10;
+   info.nodes = nodes;
+   return true;
+}
+
+// Returns the info_string_keyword flags for all keywords found in the line.
+unsigned int find_info_string_keywords(string_view line)
+{
+   unsigned int keywords = 0;
+   size_t len = line.length();
+
+   for (size_t i = 0; i < len; i++)
+   {
+      char c = to_lower(line[i]);
+
+      if (c == 'i')
+      {
+         if (matches_at(line, i, "illegal ") || matches_at(line, i, "invalid "))
+         {
+            if (matches_at(line, i + 8, "move"))
+               keywords |= KEYWORD_ILLEGAL_MOVE;
+            else if (matches_at(line, i + 8, "fen") || matches_at(line, i + 8, "position"))
+               keywords |= KEYWORD_INVALID_POSITION;
+         }
+      }
+      else if (c == 'w')
+      {
+         if (matches_at(line, i, "white won"))
+            keywords |= KEYWORD_WHITE_WON;
+      }
+      else if (c == 'b')
+      {
+         if (matches_at(line, i, "black won"))
+            keywords |= KEYWORD_BLACK_WON;
+         else if (matches_at(line, i, "bg won"))
+            keywords |= KEYWORD_BG_WON;
+      }
+      else if (c == 'r')
+      {
+         if (matches_at(line, i, "ry won"))
+            keywords |= KEYWORD_RY_WON;
+      }
+      else if (c == 's')
+      {
+         if (matches_at(line, i, "stalemate"))
+            keywords |= KEYWORD_STALEMATE;
+      }
+      else if (c == 'o')
+      {
+         if (matches_at(line, i, "offer draw"))
+            keywords |= KEYWORD_OFFER_DRAW;
+      }
+   }
+   return keywords;
+}
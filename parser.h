@@ -0,0 +1,42 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string_view>
+#include <cstdint>
+
+using namespace std;
+
+// Search info reported by an engine in a UCI "info" line, or in an xboard thinking output line.
+// Fields that are not present in the line are set to -1 (has_score is set to false).
+struct search_info
+{
+   bool has_score;
+   bool mate_score;     // true for "score mate N", false for "score cp N"
+   int score;           // centipawns, or number of moves to mate
+   int depth;
+   int64_t nodes;
+   int64_t nps;
+   int64_t time_ms;
+};
+
+// Keywords found in a UCI "info string" line (case-insensitive).
+enum info_string_keyword
+{
+   KEYWORD_ILLEGAL_MOVE       = 0x01,   // "illegal move" or "invalid move"
+   KEYWORD_INVALID_POSITION   = 0x02,   // "invalid fen", "invalid position", "illegal fen" or "illegal position"
+   KEYWORD_WHITE_WON          = 0x04,   // "white won"
+   KEYWORD_BLACK_WON          = 0x08,   // "black won"
+   KEYWORD_RY_WON             = 0x10,   // "ry won" (4pchess)
+   KEYWORD_BG_WON             = 0x20,   // "bg won" (4pchess)
+   KEYWORD_STALEMATE          = 0x40,   // "stalemate"
+   KEYWORD_OFFER_DRAW         = 0x80    // "offer draw"
+};
+
+void reset_search_info(search_info &info);
+
+// These functions parse a line in a single pass, without any heap allocation.
+bool parse_uci_info(string_view line, search_info &info);
+bool parse_xboard_thinking(string_view line, search_info &info);
+unsigned int find_info_string_keywords(string_view line);
+
+#endif // PARSER_H
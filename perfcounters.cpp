@@ -0,0 +1,116 @@
+#include "perfcounters.h"
+#include <fstream>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+PerfCounters::PerfCounters(void)
+{
+   for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+      m_fd[i] = -1;
+}
+
+PerfCounters::~PerfCounters(void)
+{
+   close();
+}
+
+const char *perf_counter_name(perf_counter counter)
+{
+   if (counter == PERF_INSTRUCTIONS)
+      return "instructions";
+   else if (counter == PERF_CYCLES)
+      return "cycles";
+   else if (counter == PERF_CACHE_MISSES)
+      return "cache-misses";
+   else
+      return "branch-misses";
+}
+
+bool PerfCounters::is_open(void)
+{
+   for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+      if (m_fd[i] != -1)
+         return true;
+   return false;
+}
+
+// Open the counters on process pid. The counters are inherited, so that the engine's search threads are counted,
+// and they aren't grouped, because inherited counters can't be read as a group.
+// Returns 0 if no counter could be opened, with the reason in error. Counters the CPU doesn't support stay unavailable.
+int PerfCounters::open(int pid, string &error)
+{
+#ifdef __linux__
+   const uint64_t configs[PERF_NUM_COUNTERS] = { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+   int open_errno = 0;
+
+   close();
+   for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+   {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // with more counters than the PMU has, the kernel multiplexes them, and the values are scaled by enabled / running time.
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      m_fd[i] = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+      if (m_fd[i] == -1)
+         open_errno = errno;
+   }
+   if (is_open())
+      return 1;
+
+   error = strerror(open_errno);
+   if ((open_errno == EACCES) || (open_errno == EPERM))
+   {
+      ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+      string level;
+      getline(paranoid, level);
+      error += " (perf_event_paranoid is " + level + ", it must be 2 or less)";
+   }
+   else if ((open_errno == ENOENT) || (open_errno == ENODEV) || (open_errno == EOPNOTSUPP))
+      error += " (no hardware performance counters, e.g. in a virtual machine)";
+   return 0;
+#else
+   error = "only supported on Linux";
+   return 0;
+#endif
+}
+
+void PerfCounters::read(perf_counts &counts)
+{
+   for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+   {
+      counts.value[i] = -1;
+#ifdef __linux__
+      uint64_t data[3];   // value, time enabled, time running
+      if ((m_fd[i] == -1) || (::read(m_fd[i], data, sizeof(data)) != sizeof(data)))
+         continue;
+      if ((data[2] != 0) && (data[2] < data[1]))
+         counts.value[i] = (int64_t)((double)data[0] * ((double)data[1] / data[2]));
+      else
+         counts.value[i] = (int64_t)data[0];
+#endif
+   }
+}
+
+void PerfCounters::close(void)
+{
+   for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+   {
+#ifdef __linux__
+      if (m_fd[i] != -1)
+         ::close(m_fd[i]);
+#endif
+      m_fd[i] = -1;
+   }
+}
@@ -0,0 +1,42 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+enum perf_counter
+{
+   PERF_INSTRUCTIONS,
+   PERF_CYCLES,
+   PERF_CACHE_MISSES,
+   PERF_BRANCH_MISSES,
+   PERF_NUM_COUNTERS
+};
+
+// Counter values. A counter that isn't available is -1.
+struct perf_counts
+{
+   int64_t value[PERF_NUM_COUNTERS];
+};
+
+// Hardware performance counters of a process and all threads and processes it creates after open is called
+// (perf_event_open, Linux only). User space only, so that perf_event_paranoid up to 2 allows it.
+class PerfCounters
+{
+public:
+   PerfCounters(void);
+   ~PerfCounters(void);
+   int open(int pid, string &error);
+   bool is_open(void);
+   void read(perf_counts &counts);
+   void close(void);
+
+private:
+   int m_fd[PERF_NUM_COUNTERS];
+};
+
+const char *perf_counter_name(perf_counter counter);
+
+#endif // PERFCOUNTERS_H
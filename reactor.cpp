@@ -0,0 +1,554 @@
+#include "reactor.h"
+#include "logger.h"
+#include "notifier.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+IOReactor g_reactor;
+
+IOReactor::IOReactor(void)
+{
+   m_running = false;
+   m_quit_requested = false;
+   m_start_pending = false;
+   m_max_games = 0;
+   m_total_tokens = 0;
+   m_free_tokens = 0;
+#ifdef __linux__
+   m_epoll_fd = -1;
+   m_wakeup_fd = -1;
+#endif
+}
+
+IOReactor::~IOReactor(void)
+{
+   stop();
+   for (uint i = 0; i < m_sources.size(); i++)
+      delete m_sources[i];
+#ifdef __linux__
+   if (m_epoll_fd != -1)
+      close(m_epoll_fd);
+   if (m_wakeup_fd != -1)
+      close(m_wakeup_fd);
+#endif
+}
+
+// Must be called for all games before the reactor is started.
+void IOReactor::add_game(GameManager *game)
+{
+   Engine *engines[2] = { &game->m_engine1, &game->m_engine2 };
+
+   m_games.push_back(game);
+
+   for (int i = 0; i < 2; i++)
+   {
+#ifdef __linux__
+      reactor_source_type types[3] = { SOURCE_OUTPUT, SOURCE_INPUT, SOURCE_EXIT };
+      for (int j = 0; j < 3; j++)
+      {
+         reactor_source *source = new reactor_source;
+         source->engine = engines[i];
+         source->game = game;
+         source->type = types[j];
+         source->write_wait = false;
+         m_sources.push_back(source);
+      }
+#else
+      reactor_source *source = new reactor_source;
+      source->engine = engines[i];
+      source->game = game;
+      m_sources.push_back(source);
+#endif
+   }
+}
+
+#ifdef __linux__
+int IOReactor::start(void)
+{
+   m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   m_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+   if ((m_epoll_fd == -1) || (m_wakeup_fd == -1))
+      return 0;
+
+   epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = nullptr;
+   if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &ev) == -1)
+      return 0;
+
+   for (uint i = 0; i < m_sources.size(); i++)
+   {
+      if (m_sources[i]->type == SOURCE_INPUT)
+      {
+         // the input pipe is only added to epoll while a write is waiting for room in the pipe.
+         int fd = m_sources[i]->engine->input_handle();
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+         m_sources[i]->engine->begin_cmd_batch();
+         continue;
+      }
+      if (m_sources[i]->type == SOURCE_EXIT)
+      {
+         // without a pidfd (older kernels), Engine::is_running checks the child process instead.
+         int fd = m_sources[i]->engine->exit_handle();
+         ev.events = EPOLLIN;
+         ev.data.ptr = m_sources[i];
+         if ((fd != -1) && (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0))
+            m_sources[i]->engine->set_exit_watched(true);
+         continue;
+      }
+      int fd = m_sources[i]->engine->output_handle();
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      ev.events = EPOLLIN;
+      ev.data.ptr = m_sources[i];
+      if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+         return 0;
+   }
+
+   m_running = true;
+   m_thread = thread(&IOReactor::run, this);
+   return 1;
+}
+
+void IOReactor::wake_up(void)
+{
+   uint64_t count = 1;
+   if (write(m_wakeup_fd, &count, sizeof(count)) < 0)
+      log_event("Warning: could not wake up I/O reactor");
+}
+
+void IOReactor::run(void)
+{
+   const int max_events = 64;
+   epoll_event events[max_events];
+
+   start_all_engines();
+
+   while (m_running)
+   {
+      send_quit_cmds();
+      int timeout_ms = run_timers();
+      flush_engine_cmds();
+      int n = epoll_wait(m_epoll_fd, events, max_events, timeout_ms);
+
+      for (int i = 0; i < n; i++)
+      {
+         reactor_source *source = (reactor_source *)events[i].data.ptr;
+         if (source == nullptr)
+         {
+            uint64_t count;
+            while (read(m_wakeup_fd, &count, sizeof(count)) > 0)
+               ;
+            continue;
+         }
+
+         if (source->type == SOURCE_EXIT)
+         {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source->engine->exit_handle(), nullptr);
+            source->engine->process_exited();
+            // read what the engine wrote before it exited. Its output is closed now, even if another process still holds the pipe.
+            if (!source->engine->is_output_closed())
+            {
+               while (source->engine->receive_output() > 0)
+                  ;
+               epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source->engine->output_handle(), nullptr);
+               source->engine->close_output();
+            }
+            source->game->service_engines();
+            continue;
+         }
+
+         if (source->type == SOURCE_INPUT)
+         {
+            if (source->engine->flush_engine_cmds())
+            {
+               epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source->engine->input_handle(), nullptr);
+               source->write_wait = false;
+            }
+            continue;
+         }
+
+         int len = source->engine->receive_output();
+         if ((len == 0) || ((len < 0) && (errno != EAGAIN) && (errno != EINTR)))
+         {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source->engine->output_handle(), nullptr);
+            source->engine->close_output();
+         }
+         source->game->service_engines();
+      }
+
+      continue_granted_games();
+      start_queued_games();
+   }
+}
+
+// Write the commands queued during the last loop iteration, one write per engine, or only those of one game right away.
+// If an engine's stdin pipe is full, the reactor waits for room in the pipe to write the rest.
+void IOReactor::flush_engine_cmds(GameManager *game)
+{
+   for (uint i = 0; i < m_sources.size(); i++)
+   {
+      reactor_source *source = m_sources[i];
+      if ((source->type != SOURCE_INPUT) || source->write_wait || !source->engine->has_pending_cmds() || ((game != nullptr) && (source->game != game)))
+         continue;
+      if (source->engine->flush_engine_cmds() == 0)
+      {
+         epoll_event ev;
+         ev.events = EPOLLOUT;
+         ev.data.ptr = source;
+         if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, source->engine->input_handle(), &ev) == 0)
+            source->write_wait = true;
+      }
+   }
+}
+#else
+int IOReactor::start(void)
+{
+   for (uint i = 0; i < m_sources.size(); i++)
+   {
+      m_sources[i]->closed = false;
+      m_sources[i]->queued = false;
+      m_sources[i]->engine->begin_cmd_batch();
+      m_sources[i]->reader = thread(&IOReactor::reader_loop, this, m_sources[i]);
+   }
+
+   m_running = true;
+   m_thread = thread(&IOReactor::run, this);
+   return 1;
+}
+
+void IOReactor::wake_up(void)
+{
+   m_cond.notify_one();
+}
+
+// Reader thread: blocking reads from one engine, forwarded to the reactor thread.
+void IOReactor::reader_loop(reactor_source *source)
+{
+   char buf[4096];
+   int len;
+
+   do
+   {
+      len = source->engine->read_output(buf, sizeof(buf));
+
+      lock_guard<mutex> lock(m_mutex);
+      if (len > 0)
+         source->pending.append(buf, len);
+      else
+         source->closed = true;
+      if (!source->queued)
+      {
+         source->queued = true;
+         m_ready_sources.push_back(source);
+      }
+      m_cond.notify_one();
+   } while (len > 0);
+}
+
+void IOReactor::run(void)
+{
+   vector<reactor_source *> ready;
+
+   start_all_engines();
+
+   while (m_running)
+   {
+      send_quit_cmds();
+      int timeout_ms = run_timers();
+      flush_engine_cmds();
+      {
+         unique_lock<mutex> lock(m_mutex);
+         chrono::time_point<chrono::steady_clock> deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+         while (m_ready_sources.empty() && !m_start_pending && !m_quit_requested && m_running)
+         {
+            if (timeout_ms < 0)
+               m_cond.wait(lock);
+            else if (m_cond.wait_until(lock, deadline) == cv_status::timeout)
+               break;
+         }
+         ready.swap(m_ready_sources);
+         for (uint i = 0; i < ready.size(); i++)
+         {
+            ready[i]->queued = false;
+            ready[i]->engine->append_output(ready[i]->pending.data(), ready[i]->pending.size());
+            ready[i]->pending.clear();
+            if (ready[i]->closed)
+               ready[i]->engine->close_output();
+         }
+      }
+
+      for (uint i = 0; i < ready.size(); i++)
+         ready[i]->game->service_engines();
+      ready.clear();
+
+      continue_granted_games();
+      start_queued_games();
+   }
+}
+
+// Write the commands queued during the last loop iteration, one write per engine, or only those of one game right away.
+void IOReactor::flush_engine_cmds(GameManager *game)
+{
+   for (uint i = 0; i < m_sources.size(); i++)
+      if (m_sources[i]->engine->has_pending_cmds() && ((game == nullptr) || (m_sources[i]->game == game)))
+         m_sources[i]->engine->flush_engine_cmds();
+}
+#endif
+
+// Stop the reactor thread. Engines should already be shut down, so that the reader threads (if any) can finish.
+void IOReactor::stop(void)
+{
+   if (m_running)
+   {
+      {
+         lock_guard<mutex> lock(m_mutex);
+         m_running = false;
+      }
+      wake_up();
+   }
+   if (m_thread.joinable())
+      m_thread.join();
+   for (uint i = 0; i < m_games.size(); i++)
+   {
+      m_games[i]->m_engine1.end_cmd_batch();
+      m_games[i]->m_engine2.end_cmd_batch();
+      m_games[i]->m_engine1.set_exit_watched(false);
+      m_games[i]->m_engine2.set_exit_watched(false);
+   }
+   m_games.clear();   // the games may be freed once the reactor has stopped, and stop is called again by the destructor
+#ifndef __linux__
+   for (uint i = 0; i < m_sources.size(); i++)
+      if (m_sources[i]->reader.joinable())
+         m_sources[i]->reader.join();
+#endif
+}
+
+// Called by MatchManager to queue a game. It is started by the first game slot that becomes free.
+void IOReactor::queue_game(const game_assignment &game)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_game_queue.push_back(game);
+      m_start_pending = true;
+   }
+   wake_up();
+}
+
+// Called on the reactor thread when a game ends: the game slot continues with the next queued game, unless there are more games
+// in progress than allowed (--nps-throttle). The slot that calls this is still counted as running.
+bool IOReactor::take_queued_game(game_assignment &game)
+{
+   if (num_games_running() > m_max_games)
+      return false;
+   return pop_queued_game(game);
+}
+
+bool IOReactor::pop_queued_game(game_assignment &game)
+{
+   lock_guard<mutex> lock(m_mutex);
+   if (m_game_queue.empty())
+      return false;
+   game = move(m_game_queue.front());
+   m_game_queue.pop_front();
+   return true;
+}
+
+uint IOReactor::num_queued_games(void)
+{
+   lock_guard<mutex> lock(m_mutex);
+   return (uint)m_game_queue.size();
+}
+
+// Remove the games that haven't been started yet, e.g. once an SPRT test has finished. Returns the number of games removed.
+uint IOReactor::clear_game_queue(void)
+{
+   lock_guard<mutex> lock(m_mutex);
+   uint games = (uint)m_game_queue.size();
+   m_game_queue.clear();
+   return games;
+}
+
+void IOReactor::set_max_games(uint max_games)
+{
+   {
+      lock_guard<mutex> lock(m_mutex);
+      m_max_games = max_games;
+      m_start_pending = true;
+   }
+   if (m_running)
+      wake_up();
+}
+
+uint IOReactor::num_games_running(void)
+{
+   uint games = 0;
+   for (uint i = 0; i < m_games.size(); i++)
+      if (m_games[i]->m_game_running)
+         games++;
+   return games;
+}
+
+void IOReactor::start_all_engines(void)
+{
+   for (uint i = 0; i < m_games.size(); i++)
+   {
+      m_games[i]->start_engines();
+      m_games[i]->service_engines();
+   }
+}
+
+// Limit the number of engine threads thinking at the same time. Must be called before the reactor is started.
+void IOReactor::set_think_tokens(uint tokens)
+{
+   m_total_tokens = tokens;
+   m_free_tokens = tokens;
+}
+
+// An engine takes think tokens (its number of threads) before it is sent "go", and gives them back when it moves.
+// Returns true if the tokens were granted. Otherwise the game is queued, and GameManager::think_tokens_granted is called
+// once enough tokens are free.
+bool IOReactor::acquire_think_tokens(GameManager *game, uint tokens)
+{
+   if (m_total_tokens == 0)
+      return true;
+
+   tokens = min(tokens, m_total_tokens);
+   if (m_token_queue.empty() && (m_free_tokens >= tokens))
+   {
+      m_free_tokens -= tokens;
+      game->m_think_tokens = tokens;
+      return true;
+   }
+   m_token_queue.push_back(make_pair(game, tokens));
+   return false;
+}
+
+// Give back the game's think tokens, or stop waiting for them.
+void IOReactor::release_think_tokens(GameManager *game)
+{
+   for (uint i = 0; i < m_token_queue.size(); i++)
+      if (m_token_queue[i].first == game)
+      {
+         m_token_queue.erase(m_token_queue.begin() + i);
+         break;
+      }
+   for (uint i = 0; i < m_token_grants.size(); i++)
+      if (m_token_grants[i] == game)
+      {
+         m_token_grants.erase(m_token_grants.begin() + i);
+         break;
+      }
+
+   m_free_tokens += game->m_think_tokens;
+   game->m_think_tokens = 0;
+   grant_think_tokens();
+}
+
+void IOReactor::grant_think_tokens(void)
+{
+   while (!m_token_queue.empty() && (m_free_tokens >= m_token_queue.front().second))
+   {
+      GameManager *game = m_token_queue.front().first;
+      m_free_tokens -= m_token_queue.front().second;
+      game->m_think_tokens = m_token_queue.front().second;
+      m_token_queue.pop_front();
+      m_token_grants.push_back(game);
+   }
+}
+
+// Games are continued here rather than in release_think_tokens, which is called while another game is being serviced.
+void IOReactor::continue_granted_games(void)
+{
+   while (!m_token_grants.empty())
+   {
+      GameManager *game = m_token_grants.front();
+      m_token_grants.erase(m_token_grants.begin());
+      game->think_tokens_granted();
+      game->service_engines();
+   }
+}
+
+bool IOReactor::is_running(void)
+{
+   return m_running;
+}
+
+// Ask the reactor thread to send "quit" to all engines. Only sets a flag and wakes up the reactor,
+// so it can be used from the Ctrl-C handler.
+void IOReactor::quit_all_engines(void)
+{
+#ifndef __linux__
+   lock_guard<mutex> lock(m_mutex);
+#endif
+   m_quit_requested = true;
+   wake_up();
+}
+
+void IOReactor::send_quit_cmds(void)
+{
+   if (!m_quit_requested)
+      return;
+   m_quit_requested = false;
+   for (uint i = 0; i < m_games.size(); i++)
+   {
+      m_games[i]->m_engine1.send_quit_cmd();
+      m_games[i]->m_engine2.send_quit_cmd();
+   }
+}
+
+// Start queued games on idle game slots, up to the number of concurrent games allowed.
+void IOReactor::start_queued_games(void)
+{
+   if (!m_start_pending.exchange(false))
+      return;
+
+   uint running = num_games_running();
+   bool started = false;
+   for (uint i = 0; (i < m_games.size()) && (running < m_max_games); i++)
+   {
+      GameManager *game = m_games[i];
+      game_assignment assignment;
+      if (game->m_game_running || !game->can_start_game() || !pop_queued_game(assignment))
+         continue;
+      game->start_game(assignment);
+      game->service_engines();
+      running++;
+      started = true;
+   }
+
+   // the main loop refills the queue, so that the next game is already there when a game ends
+   if (started)
+      g_main_notifier.notify();
+}
+
+// Run expired game timers. Returns the time until the next timer expires (ms), or -1 if no timer is armed.
+int IOReactor::run_timers(void)
+{
+   int timeout_ms = -1;
+
+   for (uint i = 0; i < m_games.size(); i++)
+   {
+      GameManager *game = m_games[i];
+      if (!game->m_timer_armed)
+         continue;
+
+      chrono::time_point<chrono::steady_clock> now = chrono::steady_clock::now();
+      if (game->m_timer_deadline <= now)
+      {
+         game->timer_expired();
+         game->service_engines();
+      }
+      if (game->m_timer_armed)
+      {
+         int ms = (int)chrono::duration_cast<chrono::milliseconds>(game->m_timer_deadline - now).count() + 1;
+         if ((timeout_ms < 0) || (ms < timeout_ms))
+            timeout_ms = ms;
+      }
+   }
+   return timeout_ms;
+}
@@ -0,0 +1,99 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "gamemanager.h"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#ifdef __linux__
+enum reactor_source_type
+{
+   SOURCE_OUTPUT,       // engine's stdout pipe
+   SOURCE_INPUT,        // engine's stdin pipe, written by the reactor
+   SOURCE_EXIT          // engine's pidfd, readable once the engine process exits
+};
+#endif
+
+struct reactor_source
+{
+   Engine *engine;
+   GameManager *game;
+#ifdef __linux__
+   reactor_source_type type;
+   bool write_wait;     // SOURCE_INPUT only: waiting for room in the pipe to write the rest of the queued commands
+#else
+   thread reader;
+   string pending;      // output read by the reader thread, not yet passed to the engine
+   bool closed;
+   bool queued;
+#endif
+};
+
+// IOReactor drives all games from a single thread. It reads the output of every engine and passes it to
+// the GameManager that owns the engine, which then advances its game.
+// Each GameManager is a persistent game slot: MatchManager queues games, and a slot takes the next one from the queue
+// as soon as its current game ends, or right away if it's idle, without a round trip through MatchManager.
+// On Linux, epoll is used to wait for output on the stdout pipes of all engines, and for the engine processes to exit.
+// On other platforms, a reader thread per engine forwards the engine's output to the reactor thread.
+// Commands sent to the engines on the reactor thread are batched, and written to each engine once per loop iteration.
+class IOReactor
+{
+public:
+   IOReactor(void);
+   ~IOReactor(void);
+   void add_game(GameManager *game);
+   int start(void);
+   void stop(void);
+   void queue_game(const game_assignment &game);
+   bool take_queued_game(game_assignment &game);
+   uint num_queued_games(void);
+   uint clear_game_queue(void);
+   void set_max_games(uint max_games);
+   void quit_all_engines(void);
+   bool is_running(void);
+   void set_think_tokens(uint tokens);
+   bool acquire_think_tokens(GameManager *game, uint tokens);
+   void release_think_tokens(GameManager *game);
+   void flush_engine_cmds(GameManager *game = nullptr);
+
+private:
+   vector<GameManager *> m_games;
+   vector<reactor_source *> m_sources;
+   deque<game_assignment> m_game_queue;         // protected by m_mutex
+   mutex m_mutex;
+   atomic<bool> m_start_pending;                // set under m_mutex: games were queued, or more concurrent games are allowed
+   atomic<uint> m_max_games;                    // concurrent games allowed
+   thread m_thread;
+   atomic<bool> m_running;
+   atomic<bool> m_quit_requested;
+
+   // CPU think tokens, only used on the reactor thread. m_total_tokens == 0: no limit.
+   uint m_total_tokens;
+   uint m_free_tokens;
+   deque<pair<GameManager *, uint>> m_token_queue;    // games waiting for tokens, first come first served
+   vector<GameManager *> m_token_grants;              // games that were granted tokens, to be continued by the reactor loop
+#ifdef __linux__
+   int m_epoll_fd;
+   int m_wakeup_fd;
+#else
+   condition_variable m_cond;
+   vector<reactor_source *> m_ready_sources;    // protected by m_mutex
+   void reader_loop(reactor_source *source);
+#endif
+
+   void run(void);
+   void wake_up(void);
+   void start_all_engines(void);
+   void start_queued_games(void);
+   bool pop_queued_game(game_assignment &game);
+   uint num_games_running(void);
+   void grant_think_tokens(void);
+   void continue_granted_games(void);
+   int run_timers(void);
+   void send_quit_cmds(void);
+};
+
+extern IOReactor g_reactor;
+
+#endif // REACTOR_H
@@ -18,6 +18,7 @@ int main(int argc, char* argv[])
    sigemptyset(&sig_handler.sa_mask);
    sig_handler.sa_flags = 0;
    sigaction(SIGINT, &sig_handler, NULL);
+   signal(SIGPIPE, SIG_IGN); // a write to an engine that exited must not terminate the match
 #endif
 
    if (parse_cmd_line_options(argc, argv) == 0)
@@ -37,19 +38,11 @@ int main(int argc, char* argv[])
 
    cout << "engines loaded.\n";
 
-   for (uint i = 0; i < options.num_threads; i++)
-   {
-      match_mgr.set_engine_options(&(match_mgr.m_game_mgr[i].m_engine1));
-      match_mgr.send_engine_custom_commands(&(match_mgr.m_game_mgr[i].m_engine1));
-      match_mgr.set_engine_options(&(match_mgr.m_game_mgr[i].m_engine2));
-      match_mgr.send_engine_custom_commands(&(match_mgr.m_game_mgr[i].m_engine2));
-   }
-
    match_mgr.main_loop();
 
    match_mgr.shut_down_all_engines();
+   match_mgr.finish_games();
    match_mgr.print_results(false);
-   match_mgr.save_pgn();
 
    match_mgr.cleanup();
 
@@ -61,9 +54,13 @@ int main(int argc, char* argv[])
 MatchManager::MatchManager(void)
 {
    m_total_games_started = 0;
+   m_total_games_finished = 0;
    m_engines_shut_down = false;
    m_game_mgr = nullptr;
-   m_thread = nullptr;
+   m_max_games = 0;
+   m_nps_baseline_done = false;
+   m_nps_drop[0] = 0.0;
+   m_nps_drop[1] = 0.0;
 
    for (int i = 0; i < 5; i++) m_penta[i] = 0;
 
@@ -83,35 +80,46 @@ MatchManager::~MatchManager(void)
 {
 }
 
+// Wait for the games in progress to finish once the engines have been shut down, for up to 2 seconds, then stop the
+// I/O reactor and collect the results and PGNs of all the games that finished.
+void MatchManager::finish_games(void)
+{
+   for (int x = 0; (x < 40) && (num_games_in_progress() != 0); x++)
+      this_thread::sleep_for(50ms);
+
+   g_reactor.stop();
+
+   collect_results();
+}
+
 void MatchManager::cleanup(void)
 {
+   finish_games();
+
+   // the PGN file is closed only after the last games were collected, so that their PGNs are written.
    if (m_FENs_file.is_open())
       m_FENs_file.close();
    if (m_pgn_file.is_open())
       m_pgn_file.close();
 
-   for (uint i = 0; i < options.num_threads; i++)
+   dump_latency_histograms();
+
+   if (m_cgroups.is_enabled())
    {
-      if (m_thread[i].joinable())
-      {
-         m_thread[i].join();
-         
-         uint pid = m_game_mgr[i].m_pair_id;
-         if (!m_game_mgr[i].m_swap_sides) m_pair_records[pid].g1 = m_game_mgr[i].m_final_result;
-         else                             m_pair_records[pid].g2 = m_game_mgr[i].m_final_result;
-      }
+      report_cgroup_stats();
+      m_cgroups.remove_all();
    }
-   update_penta_stats();
 
    delete[] m_game_mgr;
-   delete[] m_thread;
 
+   log_stop();
    if (g_event_log.is_open())
       g_event_log.close();
 
    if (g_debug1_log.is_open()) g_debug1_log.close();
    if (g_debug2_log.is_open()) g_debug2_log.close();
    if (g_moves_log.is_open()) g_moves_log.close();
+   if (g_debug_failed_log.is_open()) g_debug_failed_log.close();
 }
 
 void MatchManager::main_loop(void)
@@ -126,94 +134,172 @@ void MatchManager::main_loop(void)
    cout << "\n***** Press Ctrl-C to exit and terminate match *****\n\n";
 #endif
 
+   chrono::time_point<chrono::steady_clock> next_display_time = chrono::steady_clock::now();
+
    while (!match_completed())
    {
-      // 1. Join finished threads and record results
-      for (uint i = 0; i < options.num_threads; i++)
-      {
-         if (m_game_mgr[i].m_thread_running == false && m_thread[i].joinable())
-         {
-            m_thread[i].join();
-            
-            uint pid = m_game_mgr[i].m_pair_id;
-            if (!m_game_mgr[i].m_swap_sides) m_pair_records[pid].g1 = m_game_mgr[i].m_final_result;
-            else                             m_pair_records[pid].g2 = m_game_mgr[i].m_final_result;
-            
-            update_penta_stats();
-         }
-      }
+      // 1. Record results of finished games
+      collect_results();
 
-      // 2. Start new games
-      for (uint i = 0; i < options.num_threads; i++)
+      // 2. Queue new games. A game slot takes the next game from the queue as soon as its current game ends, or right away if it's idle.
+      while (new_game_can_start())
       {
-         if (!new_game_can_start())
-            break;
-         if (m_game_mgr[i].m_thread_running == false && !m_thread[i].joinable())
-         {
-            if (!swap_sides) {
-               if (get_next_fen(fen) == 0) {
-                  // Gracefully stop starting new games by pretending we hit our target game count.
-                  options.num_games_to_play = m_total_games_started;
-                  break;
-               }
+         if (!swap_sides) {
+            if (get_next_fen(fen) == 0) {
+               // Gracefully stop starting new games by pretending we hit our target game count.
+               options.num_games_to_play = m_total_games_started;
+               break;
             }
-            m_game_mgr[i].m_fen = fen;
-            m_game_mgr[i].m_swap_sides = swap_sides;
-            m_game_mgr[i].m_pair_id = current_pair_id;
+         }
+         game_assignment game;
+         game.fen = fen;
+         game.swap_sides = swap_sides;
+         game.pair_id = current_pair_id;
 
-            if (swap_sides) current_pair_id++;
-            swap_sides = !swap_sides;
+         if (swap_sides) current_pair_id++;
+         swap_sides = !swap_sides;
 
-            m_game_mgr[i].m_thread_running = true;
-            m_thread[i] = thread(&GameManager::game_runner, &m_game_mgr[i]);
-            m_total_games_started++;
-         }
+         g_reactor.queue_game(game);
+         m_total_games_started++;
       }
 
-      // 3. Wait until a thread finishes
-      while (!new_game_can_start() && !match_completed())
+      // 3. Refresh the display and check the engines on their own timer, independent of games ending.
+      chrono::time_point<chrono::steady_clock> now = chrono::steady_clock::now();
+      if (now >= next_display_time)
       {
-         this_thread::sleep_for(200ms);
+         check_nps();
          print_results();
-         save_pgn();
-         if (_kbhit())
-            return;
-         
          for (uint i = 0; i < options.num_threads; i++)
-            if (m_game_mgr[i].m_engine_disconnected || m_game_mgr[i].is_engine_unresponsive() || (!options.continue_on_error && m_game_mgr[i].m_error))
+            if (m_game_mgr[i].is_engine_unresponsive())
                return;
+         next_display_time = now + display_interval;
+      }
 
-         bool thread_finished = false;
-         for (uint i = 0; i < options.num_threads; i++) {
-            if (m_game_mgr[i].m_thread_running == false && m_thread[i].joinable()) {
-               thread_finished = true;
-               break;
-            }
-         }
-         if (thread_finished) break;
+      if (_kbhit())
+         return;
+      for (uint i = 0; i < options.num_threads; i++)
+         if (m_game_mgr[i].m_engine_disconnected || (!options.continue_on_error && m_game_mgr[i].m_error))
+            return;
+
+      // 4. Wait until a game ends, an engine fails, a key is pressed, or the display is due.
+      if (!match_completed())
+         g_main_notifier.wait(chrono::duration_cast<chrono::milliseconds>(next_display_time - now) + 1ms);
+   }
+}
+
+void MatchManager::record_pair_result(const finished_game &game)
+{
+   if (!game.swap_sides) m_pair_records[game.pair_id].g1 = game.result;
+   else                  m_pair_records[game.pair_id].g2 = game.result;
+}
+
+// Record the results of the games completed since the last call, and save their PGNs. Returns the number of games.
+uint MatchManager::collect_results(void)
+{
+   finished_game game;
+   uint games = 0;
+
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      while (m_game_mgr[i].collect_finished_game(game))
+      {
+         record_pair_result(game);
+         if (m_pgn_file.is_open() && !game.pgn.empty())
+            m_pgn_file << game.pgn;
+         games++;
       }
    }
+   if (games == 0)
+      return 0;
+   m_total_games_finished += games;
+   update_penta_stats();
+   // games not started yet aren't played once an SPRT test has finished.
+   if (m_sprt_enabled && m_sprt_test_finished)
+      m_total_games_started -= g_reactor.clear_game_queue();
+   return games;
 }
 
 bool MatchManager::match_completed(void)
 {
-   if (m_sprt_enabled && m_sprt_test_finished) return (num_games_in_progress() == 0);
+   // all games queued have been collected. The game slots' m_game_running isn't used here: a queued game is briefly
+   // neither in the queue nor running while a slot takes it.
+   if (m_sprt_enabled && m_sprt_test_finished) return (m_total_games_finished >= m_total_games_started);
 
-   return ((m_total_games_started >= options.num_games_to_play) && (num_games_in_progress() == 0));
+   return ((m_total_games_started >= options.num_games_to_play) && (m_total_games_finished >= m_total_games_started));
 }
 
+// The queue holds up to one game per concurrent game allowed, so that every game slot finds its next game there when its game ends.
 bool MatchManager::new_game_can_start(void)
 {
    if (m_sprt_enabled && m_sprt_test_finished) return false;
 
-   return ((m_total_games_started < options.num_games_to_play) && (num_games_in_progress() < options.num_threads));
+   return ((m_total_games_started < options.num_games_to_play) && (g_reactor.num_queued_games() < m_max_games));
+}
+
+// With --nps-drop, the engines' NPS baseline is measured while only one game runs. After that, every window of moves
+// is compared against the baseline, and a drop of more than nps-drop percent is logged. With --nps-throttle, the number
+// of concurrent games is reduced by one for each window with a drop, and raised again once NPS recovers.
+// If the baseline isn't complete after nps_baseline_max_games games (e.g. bullet games, or an engine that doesn't report
+// NPS), the match continues at full concurrency, and only an engine that has a baseline is monitored.
+void MatchManager::check_nps(void)
+{
+   if (options.nps_drop_percent == 0)
+      return;
+
+   if (!m_nps_baseline_done)
+   {
+      if (g_nps_monitor.has_baseline())
+         log_event("NPS baseline: Engine1 " + to_string(g_nps_monitor.baseline(0)) + ", Engine2 " + to_string(g_nps_monitor.baseline(1)));
+      else if (m_total_games_finished >= nps_baseline_max_games)
+      {
+         g_nps_monitor.close_baseline();
+         log_event("Warning: NPS baseline incomplete after " + to_string(m_total_games_finished) + " games (Engine1 " + to_string(g_nps_monitor.baseline_samples(0))
+                   + ", Engine2 " + to_string(g_nps_monitor.baseline_samples(1)) + " of " + to_string(NpsMonitor::window_size) + " moves of at least "
+                   + to_string(NpsMonitor::min_move_time_ms) + " ms with NPS), running " + to_string(options.num_threads) + " concurrent games");
+      }
+      else
+         return;
+      m_nps_baseline_done = true;
+      m_max_games = options.num_threads;
+      g_reactor.set_max_games(m_max_games);
+      return;
+   }
+
+   bool new_window = false;
+   for (int e = 0; e < 2; e++)
+   {
+      int64_t recent_nps;
+      if (!g_nps_monitor.take_window(e, recent_nps))
+         continue;
+      new_window = true;
+      m_nps_drop[e] = 100.0 * (1.0 - (double)recent_nps / g_nps_monitor.baseline(e));
+      if (m_nps_drop[e] > options.nps_drop_percent)
+         log_event("Warning: Engine" + to_string(e + 1) + " NPS dropped " + to_string((int)m_nps_drop[e]) + "% (" + to_string(recent_nps) +
+                   ", baseline " + to_string(g_nps_monitor.baseline(e)) + ") with " + to_string(num_games_in_progress()) + " concurrent games");
+   }
+   if (!new_window || !options.nps_throttle)
+      return;
+
+   double drop = max(m_nps_drop[0], m_nps_drop[1]);
+   if ((drop > options.nps_drop_percent) && (m_max_games > 1))
+   {
+      m_max_games--;
+      g_reactor.set_max_games(m_max_games);
+      log_event("NPS throttling: concurrent games reduced to " + to_string(m_max_games));
+   }
+   else if ((drop < options.nps_drop_percent / 2.0) && (m_max_games < options.num_threads))
+   {
+      m_max_games++;
+      g_reactor.set_max_games(m_max_games);
+      log_event("NPS throttling: concurrent games raised to " + to_string(m_max_games));
+   }
 }
 
 uint MatchManager::num_games_in_progress(void)
 {
    uint games = 0;
    for (uint i = 0; i < options.num_threads; i++)
-      if (m_game_mgr[i].m_thread_running)
+      if (m_game_mgr[i].m_game_running)
          games++;
    return games;
 }
@@ -232,6 +318,19 @@ int MatchManager::initialize(void)
    if (options.debug_1) g_debug1_log.open("debug_engine1.log", ios::out | ios::trunc);
    if (options.debug_2) g_debug2_log.open("debug_engine2.log", ios::out | ios::trunc);
    if (options.print_moves) g_moves_log.open("moves.log", ios::out | ios::trunc);
+   if (options.debug_failed_kb) g_debug_failed_log.open("debug_failed.log", ios::out | ios::trunc);
+
+   if (!options.transcript_dir.empty())
+   {
+      boost::system::error_code error;
+      boost::filesystem::create_directories(options.transcript_dir, error);
+      if (error)
+      {
+         cout << "Error: could not create transcript directory " << options.transcript_dir << " (" << error.message() << ")\n";
+         return 0;
+      }
+   }
+   log_start();
 
    m_sprt_enabled = options.sprt_enabled;
    if (m_sprt_enabled) {
@@ -279,15 +378,128 @@ int MatchManager::initialize(void)
    if (options.num_games_to_play % 2 != 0)
       options.num_games_to_play++; // ensure complete pairs
 
+#ifdef __linux__
+   // each game uses about 8 file descriptors (engine pipes and pidfds), so large --threads values need more than the default soft limit.
+   struct rlimit fd_limit;
+   if ((getrlimit(RLIMIT_NOFILE, &fd_limit) == 0) && (fd_limit.rlim_cur < fd_limit.rlim_max))
+   {
+      fd_limit.rlim_cur = fd_limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &fd_limit);
+   }
+#endif
+
    int num_pairs = options.num_games_to_play / 2;
    m_pair_records.resize(num_pairs);
 
    m_game_mgr = new GameManager[options.num_threads];
-   m_thread = new thread[options.num_threads];
 
+   // the NPS baseline is measured at low load, so the match starts with one game until it's done (see check_nps).
+   m_max_games = (options.nps_drop_percent != 0) ? 1 : options.num_threads;
+   g_reactor.set_max_games(m_max_games);
+   if ((m_max_games == 1) && (options.num_threads > 1))
+      log_event("NPS baseline: running one game at a time until each engine has played " + to_string(NpsMonitor::window_size) + " moves of at least "
+                + to_string(NpsMonitor::min_move_time_ms) + " ms, or for at most " + to_string(nps_baseline_max_games) + " games");
+
+   if (options.cpu_affinity && (assign_cpu_affinity() == 0))
+      return 0;
+
+   if (options.cgroups && (setup_cgroups() == 0))
+      return 0;
+
+   return 1;
+}
+
+// Give each game slot a disjoint set of CPUs, and pin both of its engines to it.
+int MatchManager::assign_cpu_affinity(void)
+{
+#ifdef __linux__
+   uint cores_per_game = max(max(options.num_cores_1, options.num_cores_2), 1u);
+   vector<vector<int>> cpu_sets;
+   vector<int> cpu_set_nodes;
+
+   if (assign_cpu_sets(options.num_threads, cores_per_game, cpu_sets, cpu_set_nodes) == 0)
+   {
+      cout << "Error: not enough CPUs to pin " << options.num_threads << " concurrent games with " << cores_per_game << " cores each\n";
+      return 0;
+   }
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      m_game_mgr[i].m_engine1.set_cpu_affinity(cpu_sets[i]);
+      m_game_mgr[i].m_engine2.set_cpu_affinity(cpu_sets[i]);
+      log_event("Game slot " + to_string(i + 1) + ": CPUs " + cpu_list_to_string(cpu_sets[i]) +
+                ((cpu_set_nodes[i] >= 0) ? (", NUMA node " + to_string(cpu_set_nodes[i])) : ", multiple NUMA nodes"));
+   }
+#else
+   cout << "Warning: --affinity is only supported on Linux\n";
+#endif
+   return 1;
+}
+
+// Run each engine in its own cgroup, so that an engine using more threads or memory than cores1/cores2 and mem1/mem2
+// is throttled or OOM killed, instead of slowing down the engines of other games.
+int MatchManager::setup_cgroups(void)
+{
+   if (m_cgroups.setup() == 0)
+      return 0;
+
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      string slot = "slot" + to_string(i + 1);
+      string path1 = m_cgroups.create_group(slot + "-engine1", max(options.num_cores_1, 1u), options.mem_size_1 + cgroup_memory_headroom_mb,
+                                            m_game_mgr[i].m_engine1.cpu_affinity());
+      string path2 = m_cgroups.create_group(slot + "-engine2", max(options.num_cores_2, 1u), options.mem_size_2 + cgroup_memory_headroom_mb,
+                                            m_game_mgr[i].m_engine2.cpu_affinity());
+      if (path1.empty() || path2.empty())
+      {
+         cout << "Error: could not create the cgroups for game slot " << (i + 1) << " (" << strerror(errno) << ")\n";
+         m_cgroups.remove_all();
+         return 0;
+      }
+      m_game_mgr[i].m_engine1.set_cgroup(path1);
+      m_game_mgr[i].m_engine2.set_cgroup(path2);
+   }
+   cout << "cgroups: each engine is limited to its cores and " << cgroup_memory_headroom_mb << " MB more than its hash size\n";
    return 1;
 }
 
+// Log each engine cgroup's CPU and memory usage, and print the totals for each engine.
+void MatchManager::report_cgroup_stats(void)
+{
+   cgroup_stats totals[2];
+
+   for (int e = 0; e < 2; e++)
+      totals[e] = { 0, 0, 0, -1, 0 };
+
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      for (int e = 0; e < 2; e++)
+      {
+         Engine *engine = (e == 0) ? &m_game_mgr[i].m_engine1 : &m_game_mgr[i].m_engine2;
+         cgroup_stats stats;
+         if (engine->cgroup().empty() || (m_cgroups.read_stats(engine->cgroup(), stats) == 0))
+            continue;
+         log_event("cgroup " + engine->cgroup() + ": usage_usec " + to_string(stats.usage_usec) + ", throttled_usec " + to_string(stats.throttled_usec) +
+                   ", nr_throttled " + to_string(stats.nr_throttled) + ", memory.peak " + to_string(stats.memory_peak) + ", oom_kill " + to_string(stats.oom_kills));
+         totals[e].usage_usec += stats.usage_usec;
+         totals[e].throttled_usec += max(stats.throttled_usec, (int64_t)0);
+         totals[e].nr_throttled += max(stats.nr_throttled, (int64_t)0);
+         totals[e].memory_peak = max(totals[e].memory_peak, stats.memory_peak);
+         totals[e].oom_kills += max(stats.oom_kills, (int64_t)0);
+      }
+   }
+
+   for (int e = 0; e < 2; e++)
+   {
+      cout << "Engine" << (e + 1) << " cgroups: CPU time " << fixed << setprecision(1) << (totals[e].usage_usec / 1e6) << " s, throttled "
+           << (totals[e].throttled_usec / 1e6) << " s (" << totals[e].nr_throttled << " periods), peak memory ";
+      if (totals[e].memory_peak >= 0)
+         cout << (totals[e].memory_peak / (1024 * 1024)) << " MB";
+      else
+         cout << "n/a";
+      cout << ", OOM kills " << totals[e].oom_kills << "\n";
+   }
+}
+
 int MatchManager::load_all_engines(void)
 {
    for (uint i = 0; i < options.num_threads; i++)
@@ -302,7 +514,74 @@ int MatchManager::load_all_engines(void)
          cout << "failed to load engine " << options.engine_file_name_2 << "\n";
          return 0;
       }
+      set_engine_options(&m_game_mgr[i].m_engine1);
+      send_engine_custom_commands(&m_game_mgr[i].m_engine1);
+      set_engine_options(&m_game_mgr[i].m_engine2);
+      send_engine_custom_commands(&m_game_mgr[i].m_engine2);
+      g_reactor.add_game(&m_game_mgr[i]);
+   }
+
+   g_reactor.set_think_tokens(options.think_tokens);
+
+   // from here on, all engine I/O is done by the reactor thread, which runs the startup handshakes of all engines in parallel.
+   if (g_reactor.start() == 0)
+   {
+      cout << "failed to start I/O reactor\n";
+      return 0;
+   }
+   return wait_for_engine_startup();
+}
+
+// Wait for all engines to complete the startup handshake ("uciok", engine options, "readyok"), then report the startup times.
+int MatchManager::wait_for_engine_startup(void)
+{
+   chrono::time_point<chrono::steady_clock> start_time = chrono::steady_clock::now();
+   uint num_started = 0;
+
+   while (num_started < options.num_threads)
+   {
+      num_started = 0;
+      for (uint i = 0; i < options.num_threads; i++)
+      {
+         if (m_game_mgr[i].m_engine_disconnected)
+         {
+            cout << "failed to start engines (see events.log)\n";
+            return 0;
+         }
+         if (m_game_mgr[i].m_engines_started)
+            num_started++;
+      }
+      if (num_started == options.num_threads)
+         break;
+
+      if (chrono::steady_clock::now() - start_time > engine_startup_timeout)
+      {
+         for (uint i = 0; i < options.num_threads; i++)
+         {
+            Engine *engines[2] = { &m_game_mgr[i].m_engine1, &m_game_mgr[i].m_engine2 };
+            for (int j = 0; j < 2; j++)
+               if (!m_game_mgr[i].m_engines_started && (engines[j]->m_startup_time_ms < 0))
+                  log_event("Error: " + engines[j]->m_name + " (" + to_string(engines[j]->m_ID) + ") did not complete startup within "
+                            + to_string(engine_startup_timeout.count()) + " seconds.");
+         }
+         cout << "failed to start engines: timeout (see events.log)\n";
+         return 0;
+      }
+      g_main_notifier.wait(100ms);
+   }
+
+   int64_t slowest_ms = 0;
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      Engine *engines[2] = { &m_game_mgr[i].m_engine1, &m_game_mgr[i].m_engine2 };
+      for (int j = 0; j < 2; j++)
+      {
+         log_event(engines[j]->m_name + " (" + to_string(engines[j]->m_ID) + ") started in " + to_string(engines[j]->m_startup_time_ms) + " ms");
+         slowest_ms = max(slowest_ms, engines[j]->m_startup_time_ms);
+      }
    }
+   cout << "engines started in " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start_time).count()
+        << " ms (slowest engine: " << slowest_ms << " ms, see events.log)\n";
    return 1;
 }
 
@@ -313,10 +592,15 @@ void MatchManager::shut_down_all_engines(void)
 
    m_engines_shut_down = true;
 
-   for (uint i = 0; i < options.num_threads; i++)
+   if (g_reactor.is_running())
+      g_reactor.quit_all_engines();
+   else
    {
-      m_game_mgr[i].m_engine1.send_quit_cmd();
-      m_game_mgr[i].m_engine2.send_quit_cmd();
+      for (uint i = 0; i < options.num_threads; i++)
+      {
+         m_game_mgr[i].m_engine1.send_quit_cmd();
+         m_game_mgr[i].m_engine2.send_quit_cmd();
+      }
    }
 
    cout << "shutting down engines...\n";
@@ -345,31 +629,31 @@ void MatchManager::set_engine_options(Engine *engine)
    if ((engine->m_number == FIRST) && (options.mem_size_1 != 0))
    {
       if (engine->m_uci)
-         engine->send_engine_cmd("setoption name Hash value " + to_string(options.mem_size_1));
+         engine->add_startup_cmd("setoption name Hash value " + to_string(options.mem_size_1));
       else
-         engine->send_engine_cmd("memory " + to_string(options.mem_size_1));
+         engine->add_startup_cmd("memory " + to_string(options.mem_size_1));
    }
    if ((engine->m_number == SECOND) && (options.mem_size_2 != 0))
    {
       if (engine->m_uci)
-         engine->send_engine_cmd("setoption name Hash value " + to_string(options.mem_size_2));
+         engine->add_startup_cmd("setoption name Hash value " + to_string(options.mem_size_2));
       else
-         engine->send_engine_cmd("memory " + to_string(options.mem_size_2));
+         engine->add_startup_cmd("memory " + to_string(options.mem_size_2));
    }
 
    if ((engine->m_number == FIRST) && (options.num_cores_1 != 0))
    {
       if (engine->m_uci)
-         engine->send_engine_cmd("setoption name Threads value " + to_string(options.num_cores_1));
+         engine->add_startup_cmd("setoption name Threads value " + to_string(options.num_cores_1));
       else
-         engine->send_engine_cmd("cores " + to_string(options.num_cores_1));
+         engine->add_startup_cmd("cores " + to_string(options.num_cores_1));
    }
    if ((engine->m_number == SECOND) && (options.num_cores_2 != 0))
    {
       if (engine->m_uci)
-         engine->send_engine_cmd("setoption name Threads value " + to_string(options.num_cores_2));
+         engine->add_startup_cmd("setoption name Threads value " + to_string(options.num_cores_2));
       else
-         engine->send_engine_cmd("cores " + to_string(options.num_cores_2));
+         engine->add_startup_cmd("cores " + to_string(options.num_cores_2));
    }
 }
 
@@ -378,12 +662,12 @@ void MatchManager::send_engine_custom_commands(Engine *engine)
    if (engine->m_number == FIRST)
    {
       for (int i = 0; i < options.custom_commands_1.size(); i++)
-         engine->send_engine_cmd(options.custom_commands_1[i]);
+         engine->add_startup_cmd(options.custom_commands_1[i]);
    }
    else
    {
       for (int i = 0; i < options.custom_commands_2.size(); i++)
-         engine->send_engine_cmd(options.custom_commands_2[i]);
+         engine->add_startup_cmd(options.custom_commands_2[i]);
    }
 }
 
@@ -391,6 +675,22 @@ void MatchManager::print_results(bool clear_screen)
 {
    uint engine1_wins = 0, engine2_wins = 0, draws = 0;
    uint illegal_move_games = 0, engine1_losses_on_time = 0, engine2_losses_on_time = 0;
+   uint64_t plies = 0;
+   clock_overhead overhead[2] = { { 0, 0, INT64_MIN }, { 0, 0, INT64_MIN } };
+   LatencyHistogram turnaround;
+   LatencyHistogram turnover;
+   uint slowest_slot = 0;
+   engine_usage usage[2] = { { 0, 0, 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0, 0, 0 } };
+   uint usage_slots[2] = { 0, 0 };
+   perf_usage perf[2];
+
+   for (int e = 0; e < 2; e++)
+   {
+      perf[e].games = 0;
+      perf[e].nodes = 0;
+      for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+         perf[e].value[c] = -1;
+   }
 
    for (uint i = 0; i < options.num_threads; i++)
    {
@@ -400,6 +700,42 @@ void MatchManager::print_results(bool clear_screen)
       illegal_move_games += m_game_mgr[i].m_illegal_move_games;
       engine1_losses_on_time += m_game_mgr[i].m_engine1_losses_on_time;
       engine2_losses_on_time += m_game_mgr[i].m_engine2_losses_on_time;
+      plies += m_game_mgr[i].m_plies;
+      for (int e = 0; e < 2; e++)
+      {
+         const clock_overhead &slot_overhead = (e == 0) ? m_game_mgr[i].m_engine1_overhead : m_game_mgr[i].m_engine2_overhead;
+         overhead[e].moves += slot_overhead.moves;
+         overhead[e].total_us += slot_overhead.total_us;
+         overhead[e].max_us = max(overhead[e].max_us, slot_overhead.max_us);
+      }
+      turnaround.merge(m_game_mgr[i].m_latency.turnaround);
+      turnover.merge(m_game_mgr[i].m_latency.turnover);
+      for (int e = 0; e < 2; e++)
+      {
+         const engine_usage &slot_usage = (e == 0) ? m_game_mgr[i].m_engine1_usage : m_game_mgr[i].m_engine2_usage;
+         if (slot_usage.games == 0)
+            continue;
+         usage_slots[e]++;
+         usage[e].games += slot_usage.games;
+         usage[e].cpu_ms += slot_usage.cpu_ms;
+         usage[e].think_ms += slot_usage.think_ms;
+         usage[e].voluntary_switches += slot_usage.voluntary_switches;
+         usage[e].involuntary_switches += slot_usage.involuntary_switches;
+         usage[e].first_rss_kb += slot_usage.first_rss_kb;
+         usage[e].rss_kb += slot_usage.rss_kb;
+         usage[e].peak_rss_kb = max(usage[e].peak_rss_kb, slot_usage.peak_rss_kb);
+      }
+      for (int e = 0; e < 2; e++)
+      {
+         const perf_usage &slot_perf = (e == 0) ? m_game_mgr[i].m_engine1_perf : m_game_mgr[i].m_engine2_perf;
+         perf[e].games += slot_perf.games;
+         perf[e].nodes += slot_perf.nodes;
+         for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+            if (slot_perf.value[c] >= 0)
+               perf[e].value[c] = max(perf[e].value[c], (int64_t)0) + slot_perf.value[c];
+      }
+      if (m_game_mgr[i].m_latency.turnaround.percentile(99) > m_game_mgr[slowest_slot].m_latency.turnaround.percentile(99))
+         slowest_slot = i;
    }
 
    int N_games = engine1_wins + engine2_wins + draws;
@@ -479,6 +815,87 @@ void MatchManager::print_results(bool clear_screen)
       if (engine1_losses_on_time != 0 || engine2_losses_on_time != 0) ss << " [Timeouts: " << engine1_losses_on_time << " / " << engine2_losses_on_time << "]";
       if (ss.str().length() > 0) ss_output << "Info  |" << ss.str() << endl;
 
+      // move time measured at the pipes minus the engines' own reported search time (avg/max per move)
+      if ((overhead[0].moves != 0) || (overhead[1].moves != 0))
+      {
+         ss_output << "Clock | overhead avg/max:";
+         for (int e = 0; e < 2; e++)
+         {
+            ss_output << ((e == 0) ? " Engine1 " : ", Engine2 ");
+            if (overhead[e].moves != 0)
+               ss_output << (overhead[e].total_us / 1000.0 / overhead[e].moves) << "/" << (overhead[e].max_us / 1000.0) << " ms";
+            else
+               ss_output << "n/a";
+         }
+         ss_output << endl;
+      }
+
+      // time from reading a move until the opponent's "go" is written (p50/p99/max), see dump_latency_histograms
+      if (turnaround.count() != 0)
+      {
+         ss_output << setprecision(3) << "Turn  | p50/p99/max " << (turnaround.percentile(50) / 1000.0) << "/" << (turnaround.percentile(99) / 1000.0) << "/"
+                   << (turnaround.max() / 1000.0) << " ms, slowest slot " << (slowest_slot + 1) << " p99 "
+                   << (m_game_mgr[slowest_slot].m_latency.turnaround.percentile(99) / 1000.0) << " ms" << setprecision(2) << endl;
+      }
+
+      // time from the end of a game until the first "go" of the next game in its slot (p50/p99/max)
+      if (turnover.count() != 0)
+      {
+         ss_output << setprecision(3) << "Next  | game turnover p50/p99/max " << (turnover.percentile(50) / 1000.0) << "/" << (turnover.percentile(99) / 1000.0) << "/"
+                   << (turnover.max() / 1000.0) << " ms" << setprecision(2) << endl;
+      }
+
+#ifdef __linux__
+      // CPU time of scm itself (not the engines), e.g. to compare harness changes with scm-mock engines (make bench)
+      rusage usage_self;
+      if ((plies != 0) && (getrusage(RUSAGE_SELF, &usage_self) == 0))
+      {
+         double cpu_us = (usage_self.ru_utime.tv_sec + usage_self.ru_stime.tv_sec) * 1e6 + usage_self.ru_utime.tv_usec + usage_self.ru_stime.tv_usec;
+         ss_output << "Plies | " << plies << ", harness CPU " << (cpu_us / 1e6) << " s, " << (cpu_us / plies) << " us/ply" << endl;
+      }
+#endif
+
+      // engine process usage (--proc): CPU time per time on the clock (threads used), RSS after the first and last game averaged over the
+      // engine processes, and context switches per game.
+      for (int e = 0; e < 2; e++)
+      {
+         if (usage_slots[e] == 0)
+            continue;
+         ss_output << "Proc" << (e + 1) << " | threads " << (usage[e].think_ms ? ((double)usage[e].cpu_ms / usage[e].think_ms) : 0.0)
+                   << ", RSS " << (usage[e].first_rss_kb / usage_slots[e] / 1024) << " -> " << (usage[e].rss_kb / usage_slots[e] / 1024)
+                   << " MB (peak " << (usage[e].peak_rss_kb / 1024) << " MB), ctx switches/game " << (usage[e].voluntary_switches / usage[e].games)
+                   << " vol " << (usage[e].involuntary_switches / usage[e].games) << " invol" << endl;
+      }
+
+      // hardware performance counters (--perf): IPC, and instructions, cache misses and branch misses per node reported by the engine
+      for (int e = 0; e < 2; e++)
+      {
+         if ((perf[e].games == 0) || (perf[e].value[PERF_INSTRUCTIONS] <= 0))
+            continue;
+         ss_output << "Perf" << (e + 1) << " |";
+         if (perf[e].value[PERF_CYCLES] > 0)
+            ss_output << " IPC " << ((double)perf[e].value[PERF_INSTRUCTIONS] / perf[e].value[PERF_CYCLES]);
+         if (perf[e].nodes > 0)
+         {
+            ss_output << ", per node: instructions " << (perf[e].value[PERF_INSTRUCTIONS] / perf[e].nodes);
+            if (perf[e].value[PERF_CACHE_MISSES] >= 0)
+               ss_output << ", cache misses " << ((double)perf[e].value[PERF_CACHE_MISSES] / perf[e].nodes);
+            if (perf[e].value[PERF_BRANCH_MISSES] >= 0)
+               ss_output << ", branch misses " << ((double)perf[e].value[PERF_BRANCH_MISSES] / perf[e].nodes);
+         }
+         ss_output << endl;
+      }
+
+      if (m_nps_baseline_done)
+      {
+         ss_output << setprecision(1) << "NPS   | drop vs baseline: Engine1 " << m_nps_drop[0] << "%, Engine2 " << m_nps_drop[1] << "%";
+         if (max(m_nps_drop[0], m_nps_drop[1]) > options.nps_drop_percent)
+            ss_output << " [WARNING: more than " << options.nps_drop_percent << "%]";
+         if (m_max_games < options.num_threads)
+            ss_output << " [throttled to " << m_max_games << " games]";
+         ss_output << setprecision(2) << endl;
+      }
+
       if (m_sprt_enabled && m_sprt_test_finished) {
          ss_output << "\nSPRT test finished: ";
          if (m_sprt_decision == SPRT_H1) ss_output << "H1 accepted (Engine 1 is stronger)." << endl;
@@ -504,6 +921,45 @@ void MatchManager::print_results(bool clear_screen)
    cout << output_str;
 }
 
+// Write the harness latency histograms of each game slot, and of all slots together, to latency.log.
+void MatchManager::dump_latency_histograms(void)
+{
+   harness_latency total;
+   ofstream file;
+
+   for (uint i = 0; i < options.num_threads; i++)
+   {
+      total.turnaround.merge(m_game_mgr[i].m_latency.turnaround);
+      total.adjudication.merge(m_game_mgr[i].m_latency.adjudication);
+      total.move_played.merge(m_game_mgr[i].m_latency.move_played);
+      total.logging.merge(m_game_mgr[i].m_latency.logging);
+      total.turnover.merge(m_game_mgr[i].m_latency.turnover);
+   }
+   if (total.turnaround.count() == 0)
+      return;
+
+   file.open("latency.log", ios::out | ios::trunc);
+   if (!file.is_open())
+      return;
+
+   for (uint i = 0; i <= options.num_threads; i++)
+   {
+      harness_latency *latency = (i < options.num_threads) ? &m_game_mgr[i].m_latency : &total;
+      const LatencyHistogram *histograms[5] = { &latency->turnaround, &latency->adjudication, &latency->move_played, &latency->logging, &latency->turnover };
+      const char *names[5] = { "turnaround", "adjudication", "move_played", "logging", "turnover" };
+
+      file << ((i < options.num_threads) ? ("Game slot " + to_string(i + 1)) : string("All game slots")) << ":\n";
+      for (int h = 0; h < 5; h++)
+      {
+         if (histograms[h]->count() == 0)
+            continue;
+         file << names[h] << ": n " << histograms[h]->count() << ", p50 " << histograms[h]->percentile(50) << " us, p90 " << histograms[h]->percentile(90)
+              << " us, p99 " << histograms[h]->percentile(99) << " us, p99.9 " << histograms[h]->percentile(99.9) << " us, max " << histograms[h]->max() << " us\n";
+         histograms[h]->dump(file);
+      }
+   }
+}
+
 int MatchManager::get_next_fen(string &fen)
 {
    if (!m_FENs_file.is_open())
@@ -520,21 +976,6 @@ int MatchManager::get_next_fen(string &fen)
    return 1;
 }
 
-void MatchManager::save_pgn(void)
-{
-   if (!m_pgn_file.is_open())
-      return;
-
-   for (uint i = 0; i < options.num_threads; i++)
-   {
-      if (m_game_mgr[i].m_pgn_valid.load(memory_order_acquire))
-      {
-         m_game_mgr[i].m_pgn_valid = false;
-         m_pgn_file << m_game_mgr[i].m_pgn;
-      }
-   }
-}
-
 void MatchManager::update_penta_stats(void)
 {
    for (int k = 0; k < 5; k++) m_penta[k] = 0;
@@ -696,6 +1137,8 @@ double MatchManager::LLR_normalized(const double p_hat[5], double nelo0, double
 
 int parse_cmd_line_options(int argc, char* argv[])
 {
+   string threads_arg;
+
    try
    {
       po::options_description desc("Command line options");
@@ -709,16 +1152,26 @@ int parse_cmd_line_options(int argc, char* argv[])
          ("cores2",     po::value<uint>(&options.num_cores_2)->default_value(1), "second engine number of cores")
          ("mem1",       po::value<uint>(&options.mem_size_1)->default_value(128), "first engine memory usage (MB)")
          ("mem2",       po::value<uint>(&options.mem_size_2)->default_value(128), "second engine memory usage (MB)")
+         ("affinity",   "pin the engines of each concurrent game to their own CPU cores (Linux only). Each game gets max(cores1, cores2) physical cores, on one NUMA node if possible.")
+         ("cgroups",    "run each engine in its own cgroup v2 group (Linux only), limited to cores1/cores2 CPUs (cpu.max), mem1/mem2 + 256 MB of memory (memory.max) and, with --affinity, its game's CPUs (cpuset). CPU time, throttling and peak memory are reported at exit. scm must be started in a delegated cgroup, e.g. with \"systemd-run --user --scope -p Delegate=yes\".")
+         ("perf",       "count hardware performance counters (instructions, cycles, cache misses, branch misses) of each engine with perf_event_open (Linux only), and report IPC and instructions per node. Needs perf_event_paranoid <= 2, and is skipped with a warning if the counters aren't available.")
+         ("proc",       "sample each engine's CPU time, RSS and context switches from /proc at the start and end of every game (Linux only), report them per engine, and add them to the PGN tags of each game")
          ("custom1",    po::value<vector<string>>(&options.custom_commands_1), "first engine custom command. e.g. --custom1 \"setoption name Style value Risky\"")
          ("custom2",    po::value<vector<string>>(&options.custom_commands_2), "second engine custom command. Note: --custom1 and --custom2 can be used more than once in the command line.")
          ("debug1",     "enable debug for first engine")
          ("debug2",     "enable debug for second engine")
+         ("debug-failed", po::value<uint>(&options.debug_failed_kb)->default_value(0), "keep the last arg KB of each game's engine I/O in memory, and write it to debug_failed.log only if the game fails (illegal move, invalid position, undetermined result, engine disconnected or loss on time). 0: off.")
+         ("transcript", po::value<string>(&options.transcript_dir), "record the exact bytes written to and read from each engine, with microsecond timestamps, to a binary transcript file per engine process in the specified directory (engine<ID>.transcript). scm-replay plays a transcript back as a fake engine.")
          ("tc",         po::value<uint>(&options.tc_ms)->default_value(10000), "time control base time (ms)")
          ("inc",        po::value<uint>(&options.tc_inc_ms)->default_value(100), "time control increment (ms)")
          ("fixed",      po::value<uint>(&options.tc_fixed_time_move_ms)->default_value(0), "time control fixed time per move (ms). This must be set to 0, unless engines should simply use a fixed amount of time per move.")
          ("margin",     po::value<uint>(&options.margin_ms)->default_value(50), "An engine loses on time if its clock goes below zero for this amount of time (ms).")
+         ("setup-delay", po::value<uint>(&options.setup_delay_ms)->default_value(0), "delay (ms) between the engines' \"readyok\" / \"pong\" after new game setup and the first move, for engines that aren't really ready when they answer. 0: the first move is sent as soon as both engines are ready.")
          ("games",      po::value<uint>(&options.num_games_to_play)->default_value(1000000), "total number of games to play")
-         ("threads",    po::value<uint>(&options.num_threads)->default_value(1), "number of concurrent games to run")
+         ("threads",    po::value<string>(&threads_arg)->default_value("1"), "number of concurrent games to run, or \"auto\" to run as many as the physical cores and available memory allow for the engines' cores1/cores2 and mem1/mem2 settings")
+         ("tokens",     po::value<uint>(&options.think_tokens)->default_value(0), "CPU think tokens: maximum number of engine threads thinking at the same time, e.g. the number of physical cores. An engine takes cores1/cores2 tokens while it is thinking, and its clock only starts once it has them. This allows --threads to be set higher than cores / engine threads. 0: no limit.")
+         ("nps-drop",   po::value<uint>(&options.nps_drop_percent)->default_value(0), "warn if an engine's NPS drops by more than this percentage from its baseline, e.g. because the machine is busy or thermally throttled. The baseline is measured from each engine's first 50 moves of 100 ms or more, while only one game runs (for at most 10 games, then the match continues at full concurrency). 0: off.")
+         ("nps-throttle", "with --nps-drop, reduce the number of concurrent games while NPS is too low, and raise it again once NPS recovers")
          ("maxmoves",   po::value<uint>(&options.max_moves)->default_value(1000), "maximum number of moves per game (total) before adjudicating draw regardless of scores")
          ("earlywin",   "adjudicate win result early if both engines report mate scores")
          ("earlydraw",  "adjudicate draw result early if both engine scores are in range (-drawscore <= score <= drawscore) for a total of drawmoves moves")
@@ -754,6 +1207,11 @@ int parse_cmd_line_options(int argc, char* argv[])
       options.uci_2 = (var_map.count("x2") == 0);
       options.debug_1 = (var_map.count("debug1") != 0);
       options.debug_2 = (var_map.count("debug2") != 0);
+      options.cpu_affinity = (var_map.count("affinity") != 0);
+      options.cgroups = (var_map.count("cgroups") != 0);
+      options.perf_counters = (var_map.count("perf") != 0);
+      options.proc_stats = (var_map.count("proc") != 0);
+      options.nps_throttle = (var_map.count("nps-throttle") != 0);
       options.continue_on_error = (var_map.count("continue") != 0);
       options.print_moves = (var_map.count("pmoves") != 0);
       options.fourplayerchess = (var_map.count("4pc") != 0);
@@ -761,6 +1219,20 @@ int parse_cmd_line_options(int argc, char* argv[])
       options.early_win = (var_map.count("earlywin") != 0);
       options.early_draw = (var_map.count("earlydraw") != 0);
       
+      if (threads_arg == "auto")
+         options.num_threads = auto_num_threads();
+      else
+      {
+         options.num_threads = 0;
+         if (!threads_arg.empty() && (threads_arg.length() <= 6) && all_of(threads_arg.begin(), threads_arg.end(), ::isdigit))
+            options.num_threads = (uint)stoul(threads_arg);
+         if (options.num_threads == 0)
+         {
+            cerr << "error: --threads must be a positive number or 'auto'\n";
+            return 0;
+         }
+      }
+
       options.sprt_enabled = (var_map.count("sprt") != 0);
       if (options.sprt_elo_model != "normalized" && options.sprt_elo_model != "logistic")
       {
@@ -779,14 +1251,45 @@ int parse_cmd_line_options(int argc, char* argv[])
       return 0;
    }
 
-   if (options.num_threads > MAX_THREADS)
-      options.num_threads = MAX_THREADS;
    if (options.num_threads > options.num_games_to_play)
       options.num_threads = options.num_games_to_play;
 
    return 1;
 }
 
+// Maximum number of concurrent games that doesn't oversubscribe the physical cores or the available memory.
+// Without think tokens, both engines of a game may be busy at the same time, so a game needs cores1 + cores2 cores.
+// With think tokens, the tokens limit the number of engine threads thinking, and only one engine per game thinks
+// at a time, so twice as many games as cores / max(cores1, cores2) keep all cores busy.
+uint auto_num_threads(void)
+{
+   const uint64_t engine_overhead_mb = 64;   // engine memory besides the hash table, e.g. NNUE network
+   uint cores = count_physical_cores();
+   uint64_t memory_mb = available_memory_mb();
+   uint cores1 = max(options.num_cores_1, 1u);
+   uint cores2 = max(options.num_cores_2, 1u);
+   uint threads;
+
+   if (options.think_tokens != 0)
+      threads = 2 * max(min(cores, options.think_tokens) / max(cores1, cores2), 1u);
+   else
+      threads = cores / (cores1 + cores2);
+
+   if (memory_mb != 0)
+   {
+      // keep 10% of the available memory free
+      uint64_t game_mb = options.mem_size_1 + options.mem_size_2 + (2 * engine_overhead_mb);
+      threads = (uint)min((uint64_t)threads, (memory_mb * 9 / 10) / game_mb);
+   }
+   threads = max(threads, 1u);
+
+   cout << "threads auto: " << threads << " concurrent games (" << cores << " physical cores";
+   if (memory_mb != 0)
+      cout << ", " << memory_mb << " MB available memory";
+   cout << ")\n";
+   return threads;
+}
+
 #ifndef WIN32
 #ifdef __linux__
 // Linux _kbhit code from https://www.flipcode.com/archives/_kbhit_for_Linux.shtml (by Morgan McGuire)
@@ -806,8 +1309,10 @@ int _kbhit(void)
       initialized = true;
    }
 
-   int bytesWaiting;
-   ioctl(STDIN, FIONREAD, &bytesWaiting);
+   // stdin may not be a terminal, e.g. /dev/null when scm is run by a script.
+   int bytesWaiting = 0;
+   if (ioctl(STDIN, FIONREAD, &bytesWaiting) == -1)
+      return 0;
    return bytesWaiting;
 }
 #else
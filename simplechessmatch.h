@@ -2,7 +2,13 @@
 #define SIMPLECHESSMATCH_H
 
 #include "gamemanager.h"
+#include "reactor.h"
+#include "topology.h"
+#include "cgroup.h"
+#include "npsmonitor.h"
+#include "notifier.h"
 #include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
 #include <fstream>
 #include <math.h>
 #include <cmath>
@@ -14,9 +20,13 @@
 #endif
 #ifdef __linux__
 #include <termios.h>
+#include <sys/resource.h>
 #endif
 
-#define MAX_THREADS 32
+const chrono::seconds engine_startup_timeout = 30s;   // for the engine startup handshake, e.g. loading NNUE and allocating hash
+const chrono::milliseconds display_interval = 200ms;   // results display refresh, and checks for unresponsive engines and NPS drops
+const uint nps_baseline_max_games = 10;              // games played one at a time for the --nps-drop baseline, before full concurrency is restored without it
+const uint64_t cgroup_memory_headroom_mb = 256;       // memory.max of an engine's cgroup is its hash size plus this, for the NNUE network, code and stacks
 
 struct PairRecord {
    game_result g1 = UNFINISHED;
@@ -24,6 +34,7 @@ struct PairRecord {
 };
 
 int parse_cmd_line_options(int argc, char* argv[]);
+uint auto_num_threads(void);
 #ifdef WIN32
 BOOL WINAPI ctrl_c_handler(DWORD fdwCtrlType);
 #else
@@ -37,11 +48,15 @@ public:
    GameManager *m_game_mgr;
 
 private:
-   thread *m_thread;
-   uint m_total_games_started;
+   uint m_total_games_started;   // games queued, including those not started by a game slot yet
+   uint m_total_games_finished;  // games collected by collect_results
    bool m_engines_shut_down;
    fstream m_FENs_file;
    fstream m_pgn_file;
+   CgroupManager m_cgroups;
+   uint m_max_games;             // concurrent games allowed now: --threads, reduced while NPS is low (--nps-throttle)
+   bool m_nps_baseline_done;
+   double m_nps_drop[2];         // NPS drop of engine1 / engine2 in the last window (percent)
 
    vector<PairRecord> m_pair_records;
    int m_penta[5];
@@ -82,12 +97,20 @@ public:
    void set_engine_options(Engine *engine);
    void send_engine_custom_commands(Engine *engine);
    void print_results(bool clear_screen = true);
-   void save_pgn(void);
+   uint collect_results(void);
+   void finish_games(void);
    void shut_down_all_engines(void);
 
 private:
+   int assign_cpu_affinity(void);
+   int setup_cgroups(void);
+   void report_cgroup_stats(void);
+   void dump_latency_histograms(void);
+   void check_nps(void);
+   int wait_for_engine_startup(void);
    bool match_completed(void);
    bool new_game_can_start(void);
+   void record_pair_result(const finished_game &game);
    uint num_games_in_progress(void);
    int get_next_fen(string &fen);
 };
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Check that an engine's last line is read when the engine exits without ending it with a newline.
+# Plays one game between two scm-mock engines, where the engine that makes the last move writes its "bestmove" without
+# a newline and exits. The move must still be played, so that the game ends with its result (0-1) instead of "*".
+
+bin_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+mock="$bin_dir/scm-mock --exit-unterminated"
+output=$(cd "$work_dir" && "$bin_dir/scm" --e1 "$mock" --e2 "$mock" --games 1 --threads 1 --tc 60000 --inc 1000 --pgn game.pgn < /dev/null 2>&1)
+
+if ! grep -q '^\[Result "0-1"\]' "$work_dir/game.pgn" 2>/dev/null; then
+   echo "FAIL: the last move, written without a newline, was lost"
+   grep '^\[Result' "$work_dir/game.pgn" 2>/dev/null
+   echo "$output" | tail -n 20
+   exit 1
+fi
+echo "OK: last line without a newline read"
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Check that resignations are kept in PGN4 output when a slot goes straight on to a queued game.
+# Runs a 4PC match between two scm-mock xboard engines that resign every game. With --threads 1, each game after the
+# first is set up while the previous one is being finalized, and every game must still end in "R" (resigned), not "#".
+#
+# usage: check_pgn4_resign.sh [games]
+# games: default 8
+
+games=${1:-8}
+
+bin_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+mock="$bin_dir/scm-mock --plies 9 --resign"
+output=$(cd "$work_dir" && "$bin_dir/scm" --4pc --x1 --x2 --e1 "$mock" --e2 "$mock" --games "$games" --threads 1 --tc 60000 --inc 1000 \
+         --fens "$bin_dir/FENs_4PC_balanced.txt" --pgn4 games.pgn4 < /dev/null 2>&1)
+
+resigned=$(grep -c " R$" "$work_dir/games.pgn4" 2>/dev/null)
+if [ "${resigned:-0}" -ne "$games" ]; then
+   echo "FAIL: $games games played, ${resigned:-0} recorded as resigned in the PGN4 file"
+   echo "$output" | tail -n 20
+   exit 1
+fi
+echo "OK: $games resigned 4PC games recorded with R"
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Check that the PGN file has a game for every game counted in the results, including the games that finish while the
+# match shuts down. Plays a complete match, and a match interrupted with Ctrl-C (SIGINT), between scm-mock engines with
+# --threads 4, and compares the "Games | N:" count with the number of decided games in the PGN file. In the interrupted
+# match, the engines are slow to quit, so scm kills them, and the games in progress must be saved too (result "*").
+#
+# usage: check_pgn_count.sh [games]
+# games: games in the complete match, default 40
+
+games=${1:-40}
+
+bin_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+# run_match name timeout_signal_args scm-mock_options games
+run_match()
+{
+   output=$(cd "$work_dir" && $2 "$bin_dir/scm" --e1 "$bin_dir/scm-mock $3" --e2 "$bin_dir/scm-mock $3" --games "$4" --threads 4 \
+            --tc 60000 --inc 1000 --pgn "$1.pgn" < /dev/null 2>&1)
+   reported=$(echo "$output" | sed -n 's/^Games | N: \([0-9]*\).*/\1/p' | tail -n 1)
+   saved=$(grep -c -E '^\[Result "(1-0|0-1|1/2-1/2)"\]' "$work_dir/$1.pgn" 2>/dev/null)
+   if [ -z "$reported" ] || [ "${saved:-0}" -ne "$reported" ]; then
+      echo "FAIL: $1 match: ${reported:-no} games reported, ${saved:-0} in the PGN file"
+      echo "$output" | tail -n 20
+      exit 1
+   fi
+   unfinished=$(grep -c '^\[Result "\*"\]' "$work_dir/$1.pgn")
+   echo "OK: $1 match: $reported games reported and saved, $unfinished unfinished games saved"
+}
+
+run_match complete "" "" "$games"
+[ "$unfinished" -eq 0 ] || { echo "FAIL: complete match has unfinished games"; exit 1; }
+run_match interrupted "timeout -s INT 1" "--delay 3 --quit-delay 1000" 1000
+[ "$unfinished" -gt 0 ] || { echo "FAIL: the games in progress when the match was interrupted weren't saved"; exit 1; }
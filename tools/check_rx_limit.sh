@@ -0,0 +1,30 @@
+#!/bin/sh
+# Check that buffered engine output is bounded.
+# 1. The engines write 8 MB of "info string" lines after each move, while the opponent thinks. The lines are dropped
+#    while nothing waits for the engine, so the games are played to their result (0-1).
+# 2. The same output as a single 8 MB line can't be dropped, so the engine must be disconnected with an error.
+
+bin_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+mock="$bin_dir/scm-mock --delay 100 --plies 10 --flood 8000"
+output=$(cd "$work_dir" && "$bin_dir/scm" --e1 "$mock" --e2 "$mock" --games 2 --threads 1 --tc 60000 --inc 1000 --pgn lines.pgn < /dev/null 2>&1)
+
+if grep -q 'unread output' "$work_dir/events.log" || grep '^\[Result' "$work_dir/lines.pgn" | grep -qv '"0-1"'; then
+   echo "FAIL: games with 8 MB of output lines between moves weren't played to their result"
+   grep '^\[Result' "$work_dir/lines.pgn" 2>/dev/null
+   tail -n 20 "$work_dir/events.log"
+   exit 1
+fi
+
+rm -f "$work_dir/events.log"
+mock="$bin_dir/scm-mock --delay 100 --plies 10 --flood 8000 --flood-line"
+output=$(cd "$work_dir" && timeout 60 "$bin_dir/scm" --e1 "$mock" --e2 "$mock" --games 2 --threads 1 --tc 60000 --inc 1000 < /dev/null 2>&1)
+
+if ! grep -q 'unread output' "$work_dir/events.log"; then
+   echo "FAIL: an engine that wrote an 8 MB line wasn't disconnected"
+   echo "$output" | tail -n 20
+   exit 1
+fi
+echo "OK: buffered engine output bounded"
@@ -0,0 +1,205 @@
+// scm-mock: minimal UCI / xboard engine for benchmarking and testing the harness without real searches.
+// UCI and xboard commands are both understood, so the engine can be used with --x1/--x2 or without. Every game lasts the same number of
+// plies: the engine to make the last move reports a mate in 1 (UCI) or claims the result (xboard), so that each game ends
+// with a decisive result, and the opponent then reports being mated (UCI: "bestmove 0000", xboard: claims the result).
+// Moves are not legal chess moves, but they don't repeat, so that the harness doesn't adjudicate a repetition draw.
+//
+// usage: scm-mock [--delay ms] [--info n] [--plies n] [--resign] [--quit-delay ms] [--exit-unterminated] [--flood kb]
+//                 [--flood-line]
+// --delay ms   think time per move. Default 0: answer instantly.
+// --info n     number of "info" lines (UCI) / thinking output lines (xboard) sent before each move. Default 1.
+// --plies n    game length in plies. Default 60.
+// --resign     xboard only: the engine to move after the last ply resigns, instead of the result being claimed.
+// --quit-delay ms   time taken to exit after "quit", e.g. to make the harness kill the engine at shutdown. Default 0.
+// --exit-unterminated   UCI only: the engine that makes the last move of a game writes its "bestmove" without a newline,
+//                       and exits.
+// --flood kb     UCI only: after each move, the engine writes kb KB of "info string" lines, while the opponent thinks.
+// --flood-line   the output of --flood is a single line.
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+static const char *const moves[] = { "a2a3", "b2b3", "c2c3", "d2d3", "e2e3", "f2f3", "g2g3", "h2h3", "b1a3", "b1c3", "g1f3", "g1h3",
+                                     "a7a6", "b7b6", "c7c6", "d7d6", "e7e6", "f7f6", "g7g6", "h7h6", "b8a6", "b8c6", "g8f6", "g8h6" };
+static const int num_moves = sizeof(moves) / sizeof(moves[0]);
+
+static int delay_ms = 0;
+static int info_lines = 1;
+static int game_plies = 60;
+static bool resign = false;
+static int quit_delay_ms = 0;
+static bool exit_unterminated = false;
+static int flood_kb = 0;
+static bool flood_line = false;
+
+static void out(const string &s)
+{
+   cout << s << "\n";
+}
+
+// Pseudo-random but deterministic move for a ply, without a short cycle.
+static const char *move_for_ply(int ply)
+{
+   return moves[((uint32_t)ply * 2654435761u >> 16) % num_moves];
+}
+
+static void think(bool uci, int ply)
+{
+   char line[256];
+
+   if (delay_ms > 0)
+      this_thread::sleep_for(chrono::milliseconds(delay_ms));
+   for (int i = 1; i <= info_lines; i++)
+   {
+      int nodes = i * 1000;
+      if (uci)
+         snprintf(line, sizeof(line), "info depth %d seldepth %d multipv 1 score cp %d nodes %d nps 1000000 hashfull 10 tbhits 0 time %d pv %s %s",
+                  i, i + 2, (ply * 7 + i) % 50 - 25, nodes, delay_ms, move_for_ply(ply), move_for_ply(ply + 1));
+      else
+         snprintf(line, sizeof(line), "%d %d %d %d %s %s", i, (ply * 7 + i) % 50 - 25, delay_ms / 10, nodes, move_for_ply(ply), move_for_ply(ply + 1));
+      out(line);
+   }
+}
+
+// Output written after a move, while the engine isn't expected to say anything.
+static void flood(void)
+{
+   string text(1000, 'x');
+
+   for (int i = 0; i < flood_kb; i++)
+   {
+      if (!flood_line || (i == 0))
+         cout << "info string ";
+      cout << text;
+      if (!flood_line || (i == flood_kb - 1))
+         cout << "\n";
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   for (int i = 1; i < argc; i++)
+   {
+      string arg = argv[i];
+      if (arg == "--resign")
+         resign = true;
+      else if (arg == "--exit-unterminated")
+         exit_unterminated = true;
+      else if (arg == "--flood-line")
+         flood_line = true;
+      else if (i + 1 == argc)
+         break;
+      else if (arg == "--delay")
+         delay_ms = atoi(argv[++i]);
+      else if (arg == "--info")
+         info_lines = atoi(argv[++i]);
+      else if (arg == "--plies")
+         game_plies = max(2, atoi(argv[++i]));
+      else if (arg == "--quit-delay")
+         quit_delay_ms = atoi(argv[++i]);
+      else if (arg == "--flood")
+         flood_kb = atoi(argv[++i]);
+   }
+
+   ios::sync_with_stdio(false);
+
+   string line;
+   int ply = 0;          // plies played in the current game
+   bool force = false;   // xboard only
+
+   while (getline(cin, line))
+   {
+      if (!line.empty() && (line.back() == '\r'))
+         line.pop_back();
+
+      // UCI
+      if (line == "uci")
+         out("id name scm-mock\nid author simplechessmatch\noption name Hash type spin default 16 min 1 max 65536\n"
+             "option name Threads type spin default 1 min 1 max 1024\nuciok");
+      else if (line == "isready")
+         out("readyok");
+      else if (line.compare(0, 9, "position ") == 0)
+      {
+         // the number of moves played is the number of tokens after "moves"
+         ply = 0;
+         size_t pos = line.find(" moves");
+         if (pos != string::npos)
+         {
+            bool in_token = false;
+            for (size_t i = pos + 6; i < line.size(); i++)
+            {
+               if ((line[i] != ' ') && !in_token)
+                  ply++;
+               in_token = (line[i] != ' ');
+            }
+         }
+      }
+      else if (line.compare(0, 3, "go ") == 0)
+      {
+         think(true, ply);
+         if (ply >= game_plies)
+            out("info depth 1 score mate -1\nbestmove 0000");
+         else if ((ply == game_plies - 1) && exit_unterminated)
+         {
+            cout << "info depth 1 score mate 1\nbestmove " << move_for_ply(ply);
+            cout.flush();
+            return 0;
+         }
+         else if (ply == game_plies - 1)
+            out("info depth 1 score mate 1\nbestmove " + string(move_for_ply(ply)));
+         else
+            out("bestmove " + string(move_for_ply(ply)));
+         cout.flush();
+         flood();
+      }
+
+      // xboard
+      else if (line.compare(0, 8, "protover") == 0)
+         out("feature ping=1 setboard=1 usermove=1 colors=0 myname=\"scm-mock\" done=1");
+      else if (line.compare(0, 5, "ping ") == 0)
+         out("pong " + line.substr(5));
+      else if (line == "new")
+      {
+         ply = 0;
+         force = false;
+      }
+      else if (line == "force")
+         force = true;
+      else if ((line == "go") || (line.compare(0, 9, "usermove ") == 0))
+      {
+         if (line == "go")
+            force = false;
+         else
+            ply++;
+         // the engine that makes the last move claims the win, and its opponent then claims the loss instead of moving.
+         string result = (game_plies % 2) ? "1-0 {White mates}" : "0-1 {Black mates}";
+         if (!force && (ply < game_plies))
+         {
+            think(false, ply);
+            out("move " + string(move_for_ply(ply)));
+            ply++;
+            if ((ply == game_plies) && !resign)
+               out(result);
+         }
+         else if (!force)
+            out(resign ? "resign" : result);
+      }
+      else if (line == "quit")
+      {
+         if (quit_delay_ms > 0)
+            this_thread::sleep_for(chrono::milliseconds(quit_delay_ms));
+         break;
+      }
+
+      cout.flush();
+   }
+   return 0;
+}
@@ -0,0 +1,107 @@
+// scm-replay: fake UCI / xboard engine that plays back a transcript recorded with --transcript.
+// The recorded engine output is written with its original timing, relative to the harness input it followed:
+// before each recorded output chunk, scm-replay waits until it has read as many input lines as the engine had been sent,
+// then for the recorded time since the last of those inputs. Moves and results are replayed as recorded, so a game
+// plays out exactly like the recorded one when the harness sends the same positions.
+//
+// usage: scm-replay [--speed X] [--verify] transcript_file
+// --speed X   play back X times faster (e.g. 2), or without any delays if X is 0. Default 1.
+// --verify    report input lines that differ from the recorded input on stderr, e.g. a different clock or position.
+//
+// e.g. scm --e1 "./scm-replay transcripts/engine1.transcript" --e2 "./scm-replay transcripts/engine2.transcript"
+
+#include "transcript.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cstdlib>
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+   string file_name;
+   double speed = 1.0;
+   bool verify = false;
+
+   for (int i = 1; i < argc; i++)
+   {
+      string arg = argv[i];
+      if ((arg == "--speed") && (i + 1 < argc))
+         speed = atof(argv[++i]);
+      else if (arg == "--verify")
+         verify = true;
+      else
+         file_name = arg;
+   }
+   if (file_name.empty() || (speed < 0.0))
+   {
+      cerr << "usage: scm-replay [--speed X] [--verify] transcript_file\n";
+      return 1;
+   }
+
+   TranscriptReader reader;
+   string error;
+   if (reader.open(file_name, error) == 0)
+   {
+      cerr << "scm-replay: " << error << "\n";
+      return 1;
+   }
+
+   ios::sync_with_stdio(false);
+
+   transcript_record type;
+   uint64_t time_us;
+   string data;
+   string expected_line;                  // recorded input, split into lines for --verify
+   uint64_t lines_expected = 0;           // input lines the engine had been sent so far
+   uint64_t lines_read = 0;
+   uint64_t anchor_us = 0;                // recorded time of the last input
+   chrono::time_point<chrono::steady_clock> anchor_time = chrono::steady_clock::now();
+   string line;
+
+   int status;
+   while ((status = reader.next(type, time_us, data, error)) > 0)
+   {
+      if (type == TRANSCRIPT_TO_ENGINE)
+      {
+         for (char c : data)
+         {
+            if (c != '\n')
+            {
+               expected_line.push_back(c);
+               continue;
+            }
+            lines_expected++;
+            if (!getline(cin, line))
+               return 0;   // the harness closed our input
+            lines_read++;
+            if (verify && (line != expected_line))
+               cerr << "scm-replay: input line " << lines_read << " differs: expected \"" << expected_line << "\", got \"" << line << "\"\n";
+            expected_line.clear();
+         }
+         anchor_us = time_us;
+         anchor_time = chrono::steady_clock::now();
+      }
+      else if (type == TRANSCRIPT_FROM_ENGINE)
+      {
+         if (speed > 0.0)
+            this_thread::sleep_until(anchor_time + chrono::microseconds((int64_t)((time_us - anchor_us) / speed)));
+         cout.write(data.data(), data.size());
+         cout.flush();
+      }
+      else
+         return 0;   // the recorded engine exited here
+   }
+
+   if (status < 0)
+   {
+      cerr << "scm-replay: " << file_name << ": " << error << "\n";
+      return 1;
+   }
+
+   // end of the transcript (e.g. the recording was cut short): read input until the harness closes it.
+   while (getline(cin, line))
+      ;
+   return 0;
+}
@@ -0,0 +1,241 @@
+#include "topology.h"
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+struct cpu_unit
+{
+   vector<int> cpus;    // CPUs that are assigned together: all hardware threads of a physical core, or a single hardware thread
+   int node;
+};
+
+static string read_sys_file(const string &path)
+{
+   ifstream file(path);
+   string s;
+   getline(file, s);
+   return s;
+}
+
+static int read_sys_int(const string &path, int default_value)
+{
+   try
+   {
+      return stoi(read_sys_file(path));
+   }
+   catch (...)
+   {
+      return default_value;
+   }
+}
+
+// Parse a CPU list in the format used in /sys, e.g. "0-3,8-11".
+static vector<int> parse_cpu_list(const string &s)
+{
+   vector<int> cpu_list;
+   size_t pos = 0;
+
+   while (pos < s.length())
+   {
+      size_t end = s.find(',', pos);
+      if (end == string::npos)
+         end = s.length();
+      string range = s.substr(pos, end - pos);
+      size_t dash = range.find('-');
+      try
+      {
+         int first = stoi(range);
+         int last = (dash == string::npos) ? first : stoi(range.substr(dash + 1));
+         for (int cpu = first; cpu <= last; cpu++)
+            cpu_list.push_back(cpu);
+      }
+      catch (...)
+      {
+      }
+      pos = end + 1;
+   }
+   return cpu_list;
+}
+
+string cpu_list_to_string(const vector<int> &cpu_list)
+{
+   string s;
+
+   for (size_t i = 0; i < cpu_list.size(); i++)
+   {
+      size_t j = i;
+      while ((j + 1 < cpu_list.size()) && (cpu_list[j + 1] == cpu_list[j] + 1))
+         j++;
+      if (!s.empty())
+         s += ",";
+      s += to_string(cpu_list[i]);
+      if (j > i)
+         s += "-" + to_string(cpu_list[j]);
+      i = j;
+   }
+   return s;
+}
+
+// Read the online CPUs that this process may run on, with their NUMA node, package and core IDs.
+int read_cpu_topology(vector<cpu_info> &cpus)
+{
+   cpus.clear();
+#ifdef __linux__
+   const string cpu_dir = "/sys/devices/system/cpu/";
+   const string node_dir = "/sys/devices/system/node/";
+   vector<int> online = parse_cpu_list(read_sys_file(cpu_dir + "online"));
+   cpu_set_t allowed;
+   bool check_allowed = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+
+   for (size_t i = 0; i < online.size(); i++)
+   {
+      int cpu = online[i];
+      if ((cpu >= CPU_SETSIZE) || (check_allowed && !CPU_ISSET(cpu, &allowed)))
+         continue;
+      string topology_dir = cpu_dir + "cpu" + to_string(cpu) + "/topology/";
+      cpu_info info;
+      info.cpu = cpu;
+      info.node = 0;
+      info.package = read_sys_int(topology_dir + "physical_package_id", 0);
+      info.core = read_sys_int(topology_dir + "core_id", cpu);
+      cpus.push_back(info);
+   }
+
+   // machines without NUMA support have no node directory, and everything is on node 0.
+   vector<int> nodes = parse_cpu_list(read_sys_file(node_dir + "online"));
+   for (size_t n = 0; n < nodes.size(); n++)
+   {
+      vector<int> node_cpus = parse_cpu_list(read_sys_file(node_dir + "node" + to_string(nodes[n]) + "/cpulist"));
+      for (size_t i = 0; i < cpus.size(); i++)
+         if (find(node_cpus.begin(), node_cpus.end(), cpus[i].cpu) != node_cpus.end())
+            cpus[i].node = nodes[n];
+   }
+#endif
+   return (cpus.empty() ? 0 : 1);
+}
+
+// Number of physical cores this process may run on (SMT siblings are counted once).
+// Falls back to the number of hardware threads if the topology isn't available.
+uint count_physical_cores(void)
+{
+   vector<cpu_info> cpus;
+   vector<cpu_info> cores;
+
+   if (read_cpu_topology(cpus) == 0)
+      return max(thread::hardware_concurrency(), 1u);
+
+   for (size_t i = 0; i < cpus.size(); i++)
+   {
+      bool found = false;
+      for (size_t j = 0; (j < cores.size()) && !found; j++)
+         found = ((cores[j].node == cpus[i].node) && (cores[j].package == cpus[i].package) && (cores[j].core == cpus[i].core));
+      if (!found)
+         cores.push_back(cpus[i]);
+   }
+   return (uint)cores.size();
+}
+
+// Memory available for new processes without swapping (MB), or 0 if unknown.
+uint64_t available_memory_mb(void)
+{
+#ifdef __linux__
+   ifstream file("/proc/meminfo");
+   string name;
+   uint64_t value;
+   string unit;
+
+   while (file >> name >> value >> unit)
+      if (name == "MemAvailable:")
+         return value / 1024;
+#endif
+   return 0;
+}
+
+// Assign units to each set, first fit. A set's units are taken from a single NUMA node if any node has enough free units.
+static int assign_units(const vector<cpu_unit> &units, uint num_sets, uint units_per_set, vector<vector<int>> &cpu_sets, vector<int> &cpu_set_nodes)
+{
+   vector<bool> used(units.size(), false);
+
+   cpu_sets.assign(num_sets, vector<int>());
+   cpu_set_nodes.assign(num_sets, -1);
+
+   for (uint set = 0; set < num_sets; set++)
+   {
+      vector<size_t> chosen;
+
+      for (size_t first = 0; (first < units.size()) && (chosen.size() < units_per_set); first++)
+      {
+         if (used[first])
+            continue;
+         chosen.clear();
+         for (size_t i = first; (i < units.size()) && (chosen.size() < units_per_set); i++)
+            if (!used[i] && (units[i].node == units[first].node))
+               chosen.push_back(i);
+         if (chosen.size() == units_per_set)
+            cpu_set_nodes[set] = units[first].node;
+      }
+
+      // no node has enough free units: the set spans nodes.
+      if (chosen.size() < units_per_set)
+      {
+         chosen.clear();
+         for (size_t i = 0; (i < units.size()) && (chosen.size() < units_per_set); i++)
+            if (!used[i])
+               chosen.push_back(i);
+      }
+      if (chosen.size() < units_per_set)
+         return 0;
+
+      for (size_t i = 0; i < chosen.size(); i++)
+      {
+         used[chosen[i]] = true;
+         cpu_sets[set].insert(cpu_sets[set].end(), units[chosen[i]].cpus.begin(), units[chosen[i]].cpus.end());
+      }
+      sort(cpu_sets[set].begin(), cpu_sets[set].end());
+   }
+   return 1;
+}
+
+// Assign num_sets disjoint sets of CPUs, each with cores_per_set physical cores on one NUMA node where possible.
+// A set gets all hardware threads of its cores, so that no two sets share a physical core. If there aren't enough
+// physical cores for that, sets get single hardware threads instead, spread over as many physical cores as possible.
+// cpu_set_nodes is set to each set's NUMA node, or -1 if the set spans nodes. Returns 0 if there aren't enough CPUs.
+int assign_cpu_sets(uint num_sets, uint cores_per_set, vector<vector<int>> &cpu_sets, vector<int> &cpu_set_nodes)
+{
+   vector<cpu_info> cpus;
+   vector<int> thread_index;
+   vector<cpu_unit> units;
+
+   if (read_cpu_topology(cpus) == 0)
+      return 0;
+
+   sort(cpus.begin(), cpus.end(), [](const cpu_info &a, const cpu_info &b)
+        { return (a.node != b.node) ? (a.node < b.node) : (a.package != b.package) ? (a.package < b.package) : (a.core != b.core) ? (a.core < b.core) : (a.cpu < b.cpu); });
+
+   // whole physical cores
+   for (size_t i = 0; i < cpus.size(); i++)
+   {
+      bool same_core = (i > 0) && (cpus[i].node == cpus[i - 1].node) && (cpus[i].package == cpus[i - 1].package) && (cpus[i].core == cpus[i - 1].core);
+      thread_index.push_back(same_core ? (thread_index[i - 1] + 1) : 0);
+      if (same_core)
+         units.back().cpus.push_back(cpus[i].cpu);
+      else
+         units.push_back({ { cpus[i].cpu }, cpus[i].node });
+   }
+   if (assign_units(units, num_sets, cores_per_set, cpu_sets, cpu_set_nodes))
+      return 1;
+
+   // single hardware threads: the first thread of every core on a node comes before the second thread of any core.
+   vector<size_t> order;
+   for (size_t i = 0; i < cpus.size(); i++)
+      order.push_back(i);
+   stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+               { return (cpus[a].node != cpus[b].node) ? (cpus[a].node < cpus[b].node) : (thread_index[a] < thread_index[b]); });
+   units.clear();
+   for (size_t i = 0; i < order.size(); i++)
+      units.push_back({ { cpus[order[i]].cpu }, cpus[order[i]].node });
+   return assign_units(units, num_sets, cores_per_set, cpu_sets, cpu_set_nodes);
+}
@@ -0,0 +1,26 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+typedef unsigned int uint;
+
+struct cpu_info
+{
+   int cpu;          // logical CPU number
+   int node;         // NUMA node
+   int package;      // physical package (socket)
+   int core;         // physical core ID within the package
+};
+
+int read_cpu_topology(vector<cpu_info> &cpus);
+int assign_cpu_sets(uint num_sets, uint cores_per_set, vector<vector<int>> &cpu_sets, vector<int> &cpu_set_nodes);
+string cpu_list_to_string(const vector<int> &cpu_list);
+uint count_physical_cores(void);
+uint64_t available_memory_mb(void);
+
+#endif // TOPOLOGY_H
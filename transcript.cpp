@@ -0,0 +1,135 @@
+#include "transcript.h"
+#include <cstring>
+
+int TranscriptWriter::open(const string &path, const string &engine_file_name, chrono::time_point<chrono::steady_clock> start_time)
+{
+   close();
+   m_file.open(path, ios::out | ios::binary | ios::trunc);
+   if (!m_file.is_open())
+      return 0;
+   m_file.write(transcript_magic, sizeof(transcript_magic));
+   m_file.put((char)transcript_version);
+   write_varint(engine_file_name.size());
+   m_file.write(engine_file_name.data(), engine_file_name.size());
+   m_last_time = start_time;
+   return 1;
+}
+
+bool TranscriptWriter::is_open(void)
+{
+   return m_file.is_open();
+}
+
+// The file is only written once its stream buffer is full, so that recording doesn't add a syscall to each pipe read / write.
+void TranscriptWriter::record(transcript_record type, chrono::time_point<chrono::steady_clock> time, const char *data, size_t len)
+{
+   if (!m_file.is_open())
+      return;
+   int64_t delta_us = chrono::duration_cast<chrono::microseconds>(time - m_last_time).count();
+   if (delta_us < 0)
+      delta_us = 0;
+   else
+      m_last_time = time;
+   m_file.put((char)type);
+   write_varint((uint64_t)delta_us);
+   write_varint(len);
+   m_file.write(data, len);
+}
+
+void TranscriptWriter::close(void)
+{
+   if (m_file.is_open())
+      m_file.close();
+}
+
+void TranscriptWriter::write_varint(uint64_t value)
+{
+   while (value >= 0x80)
+   {
+      m_file.put((char)((value & 0x7f) | 0x80));
+      value >>= 7;
+   }
+   m_file.put((char)value);
+}
+
+int TranscriptReader::open(const string &path, string &error)
+{
+   char magic[sizeof(transcript_magic)];
+   uint64_t len;
+
+   m_file.open(path, ios::in | ios::binary | ios::ate);
+   if (!m_file.is_open())
+   {
+      error = "could not open " + path;
+      return 0;
+   }
+   m_file_size = (uint64_t)m_file.tellg();
+   m_file.seekg(0);
+   if (!m_file.read(magic, sizeof(magic)) || (memcmp(magic, transcript_magic, sizeof(magic)) != 0))
+   {
+      error = path + " is not a transcript";
+      return 0;
+   }
+   if (m_file.get() != transcript_version)
+   {
+      error = path + ": unsupported transcript version";
+      return 0;
+   }
+   if (!read_varint(len) || (len > bytes_left()))
+   {
+      error = path + ": truncated header";
+      return 0;
+   }
+   m_engine_file_name.resize(len);
+   m_file.read(&m_engine_file_name[0], len);
+   m_time_us = 0;
+   return 1;
+}
+
+// Read the next record. time_us is the time since the engine was launched. Returns 0 at the end of the transcript,
+// and -1 with an error for a truncated or corrupt record. A record's length is checked against the rest of the file
+// before its data is read, so a corrupt length can't cause a huge allocation.
+int TranscriptReader::next(transcript_record &type, uint64_t &time_us, string &data, string &error)
+{
+   uint64_t offset = (uint64_t)m_file.tellg();
+   uint64_t delta_us, len;
+   int c = m_file.get();
+   if (c == EOF)
+      return 0;
+   if ((c < TRANSCRIPT_TO_ENGINE) || (c > TRANSCRIPT_CLOSED) || !read_varint(delta_us) || !read_varint(len) || (len > bytes_left()))
+   {
+      error = "truncated or corrupt record at offset " + to_string(offset);
+      return -1;
+   }
+   data.resize(len);
+   if ((len != 0) && !m_file.read(&data[0], len))
+   {
+      error = "truncated record at offset " + to_string(offset);
+      return -1;
+   }
+   type = (transcript_record)c;
+   m_time_us += delta_us;
+   time_us = m_time_us;
+   return 1;
+}
+
+uint64_t TranscriptReader::bytes_left(void)
+{
+   streamoff pos = m_file.tellg();
+   return ((pos < 0) || ((uint64_t)pos > m_file_size)) ? 0 : (m_file_size - (uint64_t)pos);
+}
+
+bool TranscriptReader::read_varint(uint64_t &value)
+{
+   value = 0;
+   for (int shift = 0; shift < 64; shift += 7)
+   {
+      int c = m_file.get();
+      if (c == EOF)
+         return false;
+      value |= (uint64_t)(c & 0x7f) << shift;
+      if ((c & 0x80) == 0)
+         return true;
+   }
+   return false;
+}
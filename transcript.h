@@ -0,0 +1,60 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+// Binary transcript of the bytes written to and read from an engine (--transcript), played back by scm-replay.
+//
+// File format: the magic "SCMT", a version byte, and the engine's file name (varint length + bytes), followed by records:
+//    type       1 byte, transcript_record
+//    time       varint, microseconds since the previous record (the first record: since the engine was launched)
+//    length     varint, number of data bytes
+//    data       the bytes exactly as they were written to / read from the pipe, in the chunks of each write / read
+// Varints are unsigned LEB128, so a typical record has 3-4 bytes of overhead.
+enum transcript_record
+{
+   TRANSCRIPT_TO_ENGINE,      // written to the engine's stdin
+   TRANSCRIPT_FROM_ENGINE,    // read from the engine's stdout
+   TRANSCRIPT_CLOSED          // the engine closed its output (exited), no data
+};
+
+const char transcript_magic[4] = { 'S', 'C', 'M', 'T' };
+const uint8_t transcript_version = 1;
+
+class TranscriptWriter
+{
+public:
+   int open(const string &path, const string &engine_file_name, chrono::time_point<chrono::steady_clock> start_time);
+   bool is_open(void);
+   void record(transcript_record type, chrono::time_point<chrono::steady_clock> time, const char *data, size_t len);
+   void close(void);
+
+private:
+   ofstream m_file;
+   chrono::time_point<chrono::steady_clock> m_last_time;
+
+   void write_varint(uint64_t value);
+};
+
+class TranscriptReader
+{
+public:
+   int open(const string &path, string &error);
+   int next(transcript_record &type, uint64_t &time_us, string &data, string &error);
+   string m_engine_file_name;
+
+private:
+   ifstream m_file;
+   uint64_t m_file_size;
+   uint64_t m_time_us;   // time of the last record since the engine was launched
+
+   bool read_varint(uint64_t &value);
+   uint64_t bytes_left(void);
+};
+
+#endif // TRANSCRIPT_H